@@ -114,6 +114,12 @@ struct xlivebg_image *xlivebg_anim_mask(int scr);
  */
 int xlivebg_memory_image(struct xlivebg_image *img, void *data, long datasz);
 unsigned int xlivebg_image_texture(struct xlivebg_image *img);
+/* Images managed by xlivebg only keep their pixels in system memory until
+ * their texture is uploaded. Plugins which need to access the pixels of an
+ * image on the CPU must call xlivebg_image_pixels to get them, instead of
+ * using the pixels field directly. From then on, they are kept in memory.
+ */
+uint32_t *xlivebg_image_pixels(struct xlivebg_image *img);
 
 int xlivebg_fit_mode(int scr);
 float xlivebg_crop_zoom(int scr);
@@ -16,11 +16,16 @@ You should have received a copy of the GNU Lesser General Public License
 along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include <string.h>
+#include <pthread.h>
 #include "imago2.h"
 #include "inttypes.h"
+#include "threads.h"
+#include "stream.h"
 
-/* pixel-format conversions are sub-optimal at the moment to avoid
- * writing a lot of code. optimize at some point ?
+/* Pixel-format conversions go through an intermediate floating point pixel,
+ * which handles every pair of formats with one unpack and one pack function
+ * per format. The most common conversions have direct integer kernels instead
+ * (see fastconv below), with SIMD variants selected at runtime.
  */
 
 #define CLAMP(x, a, b)	((x) < (a) ? (a) : ((x) > (b) ? (b) : (x)))
@@ -47,15 +52,26 @@ static void pack_rgbf(void *pptr, struct pixel *unp, int count);
 static void pack_rgbaf(void *pptr, struct pixel *unp, int count);
 static void pack_rgb565(void *pptr, struct pixel *unp, int count);
 
+typedef void (*conv_func)(void *dest, void *src, int count);
+static conv_func find_fastconv(enum img_fmt from, enum img_fmt to);
+
+struct conv_job {
+	struct img_pixmap *src, *dest;
+	conv_func func;
+};
+
+static void convert_rows(int start, int end, void *cls);
+static void convert_generic(void *dest, enum img_fmt dest_fmt, void *src, enum img_fmt src_fmt, int count);
+
 /* XXX keep in sync with enum img_fmt at imago2.h */
 static void (*unpack[])(struct pixel*, void*, int) = {
 	unpack_grey8,
 	unpack_rgb24,
 	unpack_rgba32,
-	unpack_bgra32,
 	unpack_greyf,
 	unpack_rgbf,
 	unpack_rgbaf,
+	unpack_bgra32,
 	unpack_rgb565
 };
 
@@ -64,50 +80,85 @@ static void (*pack[])(void*, struct pixel*, int) = {
 	pack_grey8,
 	pack_rgb24,
 	pack_rgba32,
-	pack_bgra32,
 	pack_greyf,
 	pack_rgbf,
 	pack_rgbaf,
+	pack_bgra32,
 	pack_rgb565
 };
 
 
 int img_convert(struct img_pixmap *img, enum img_fmt tofmt)
 {
-	struct pixel pbuf[8];
-	int bufsz = (img->width & 7) == 0 ? 8 : ((img->width & 3) == 0 ? 4 : 1);
-	int i, num_pix = img->width * img->height;
-	int num_iter = num_pix / bufsz;
-	char *sptr, *dptr;
 	struct img_pixmap nimg;
+	struct conv_job job;
 
 	if(img->fmt == tofmt) {
 		return 0;	/* nothing to do */
 	}
 
 	img_init(&nimg);
-	if(img_set_pixels(&nimg, img->width, img->height, tofmt, 0) == -1) {
+	if(img_alloc_pixels(&nimg, img->width, img->height, tofmt) == -1) {
 		img_destroy(&nimg);
 		return -1;
 	}
 
-	sptr = img->pixels;
-	dptr = nimg.pixels;
+	job.src = img;
+	job.dest = &nimg;
+	job.func = find_fastconv(img->fmt, tofmt);
+	img_parallel_rows(img->height, img->width, convert_rows, &job);
 
-	for(i=0; i<num_iter; i++) {
-		unpack[img->fmt](pbuf, sptr, bufsz);
-		pack[tofmt](dptr, pbuf, bufsz);
+	img_move(img, &nimg);
+	return 0;
+}
+
+static void convert_rows(int start, int end, void *cls)
+{
+	struct conv_job *job = cls;
+	int num_pix = (end - start) * job->src->width;
+	char *sptr = (char*)job->src->pixels + start * job->src->width * job->src->pixelsz;
+	char *dptr = (char*)job->dest->pixels + start * job->dest->width * job->dest->pixelsz;
 
-		sptr += bufsz * img->pixelsz;
-		dptr += bufsz * nimg.pixelsz;
+	if(job->func) {
+		job->func(dptr, sptr, num_pix);
+		return;
 	}
+	convert_generic(dptr, job->dest->fmt, sptr, job->src->fmt, num_pix);
+}
 
-	img_copy(img, &nimg);
-	img_destroy(&nimg);
-	return 0;
+void img_convert_pixels(void *dest, enum img_fmt dest_fmt, void *src, enum img_fmt src_fmt, int count)
+{
+	conv_func func;
+
+	if(dest_fmt == src_fmt) {
+		memcpy(dest, src, count * img_fmt_pixel_size(src_fmt));
+		return;
+	}
+	if((func = find_fastconv(src_fmt, dest_fmt))) {
+		func(dest, src, count);
+		return;
+	}
+	convert_generic(dest, dest_fmt, src, src_fmt, count);
 }
 
-/* the following functions *could* benefit from SIMD */
+/* converts through unpacked floating point pixels, a batch at a time */
+static void convert_generic(void *dest, enum img_fmt dest_fmt, void *src, enum img_fmt src_fmt, int count)
+{
+	struct pixel pbuf[8];
+	int i, n;
+	int src_pixelsz = img_fmt_pixel_size(src_fmt);
+	int dest_pixelsz = img_fmt_pixel_size(dest_fmt);
+	char *sptr = src, *dptr = dest;
+
+	for(i=0; i<count; i+=n) {
+		n = count - i < 8 ? count - i : 8;
+		unpack[src_fmt](pbuf, sptr, n);
+		pack[dest_fmt](dptr, pbuf, n);
+
+		sptr += n * src_pixelsz;
+		dptr += n * dest_pixelsz;
+	}
+}
 
 static void unpack_grey8(struct pixel *unp, void *pptr, int count)
 {
@@ -155,10 +206,10 @@ static void unpack_bgra32(struct pixel *unp, void *pptr, int count)
 	unsigned char *pix = pptr;
 
 	for(i=0; i<count; i++) {
-		unp->a = (float)*pix++ / 255.0;
-		unp->r = (float)*pix++ / 255.0;
-		unp->g = (float)*pix++ / 255.0;
 		unp->b = (float)*pix++ / 255.0;
+		unp->g = (float)*pix++ / 255.0;
+		unp->r = (float)*pix++ / 255.0;
+		unp->a = (float)*pix++ / 255.0;
 		unp++;
 	}
 }
@@ -339,3 +390,786 @@ static void pack_rgb565(void *pptr, struct pixel *unp, int count)
 		unp++;
 	}
 }
+
+
+/* ---- direct conversion kernels ----
+ * Each kernel converts count consecutive pixels. The SIMD variants process
+ * as many pixels as they can in full vectors, and leave the rest to the
+ * scalar version. Results match the generic unpack/pack path.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FASTCONV_X86
+#include <immintrin.h>
+#define TARGET(x)	__attribute__((target(x)))
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define FASTCONV_NEON
+#include <arm_neon.h>
+#endif
+
+struct fastconv {
+	enum img_fmt from, to;
+	conv_func func;
+};
+
+static void conv_grey8_rgba32(void *dest, void *src, int count);
+static void conv_rgb24_rgba32(void *dest, void *src, int count);
+static void conv_bgra32_rgba32(void *dest, void *src, int count);
+static void conv_rgba32_rgb565(void *dest, void *src, int count);
+static void conv_greyf_grey8(void *dest, void *src, int count);
+static void conv_rgbf_rgb24(void *dest, void *src, int count);
+static void conv_rgbaf_rgba32(void *dest, void *src, int count);
+static void float_to_byte_c(unsigned char *dest, float *src, int count);
+static void rgbe_to_float_c(float *dest, const unsigned char *src, int count, int width, const float *scale);
+static void rgbe_to_rgba_c(unsigned char *dest, const unsigned char *src, int count, int width,
+		const struct img_rgbe_conv *rc);
+
+static struct fastconv fastconv[] = {
+	{IMG_FMT_GREY8, IMG_FMT_RGBA32, conv_grey8_rgba32},
+	{IMG_FMT_RGB24, IMG_FMT_RGBA32, conv_rgb24_rgba32},
+	{IMG_FMT_BGRA32, IMG_FMT_RGBA32, conv_bgra32_rgba32},
+	{IMG_FMT_RGBA32, IMG_FMT_BGRA32, conv_bgra32_rgba32},	/* same swizzle */
+	{IMG_FMT_RGBA32, IMG_FMT_RGB565, conv_rgba32_rgb565},
+	{IMG_FMT_GREYF, IMG_FMT_GREY8, conv_greyf_grey8},
+	{IMG_FMT_RGBF, IMG_FMT_RGB24, conv_rgbf_rgb24},
+	{IMG_FMT_RGBAF, IMG_FMT_RGBA32, conv_rgbaf_rgba32},
+	{0, 0, 0}
+};
+
+/* converts count floats to bytes, used by the float to 8bit conversions */
+static void (*float_to_byte)(unsigned char*, float*, int) = float_to_byte_c;
+
+/* RGBE decoding kernels, see img_rgbe_to_float and img_rgbe_to_rgba */
+static void (*rgbe_to_float)(float*, const unsigned char*, int, int, const float*) = rgbe_to_float_c;
+static void (*rgbe_to_rgba)(unsigned char*, const unsigned char*, int, int,
+		const struct img_rgbe_conv*) = rgbe_to_rgba_c;
+
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void init_fastconv(void);
+
+#define INIT_FASTCONV()	pthread_once(&init_once, init_fastconv)
+
+static conv_func find_fastconv(enum img_fmt from, enum img_fmt to)
+{
+	struct fastconv *fc = fastconv;
+
+	INIT_FASTCONV();
+
+	while(fc->func) {
+		if(fc->from == from && fc->to == to) {
+			return fc->func;
+		}
+		fc++;
+	}
+	return 0;
+}
+
+static void set_fastconv(enum img_fmt from, enum img_fmt to, conv_func func)
+{
+	struct fastconv *fc = fastconv;
+
+	while(fc->func) {
+		if(fc->from == from && fc->to == to) {
+			fc->func = func;
+			return;
+		}
+		fc++;
+	}
+}
+
+static void conv_grey8_rgba32(void *dest, void *src, int count)
+{
+	int i;
+	unsigned char *sptr = src, *dptr = dest;
+
+	for(i=0; i<count; i++) {
+		dptr[0] = dptr[1] = dptr[2] = *sptr++;
+		dptr[3] = 255;
+		dptr += 4;
+	}
+}
+
+static void conv_rgb24_rgba32(void *dest, void *src, int count)
+{
+	int i;
+	unsigned char *sptr = src, *dptr = dest;
+
+	for(i=0; i<count; i++) {
+		dptr[0] = sptr[0];
+		dptr[1] = sptr[1];
+		dptr[2] = sptr[2];
+		dptr[3] = 255;
+		sptr += 3;
+		dptr += 4;
+	}
+}
+
+static void conv_bgra32_rgba32(void *dest, void *src, int count)
+{
+	int i;
+	unsigned char *sptr = src, *dptr = dest;
+
+	for(i=0; i<count; i++) {
+		dptr[0] = sptr[2];
+		dptr[1] = sptr[1];
+		dptr[2] = sptr[0];
+		dptr[3] = sptr[3];
+		sptr += 4;
+		dptr += 4;
+	}
+}
+
+static void conv_rgba32_rgb565(void *dest, void *src, int count)
+{
+	int i;
+	unsigned char *sptr = src;
+	uint16_t *dptr = dest;
+
+	for(i=0; i<count; i++) {
+		uint16_t r = sptr[0] * 31 / 255;
+		uint16_t g = sptr[1] * 63 / 255;
+		uint16_t b = sptr[2] * 31 / 255;
+		*dptr++ = (r << 11) | (g << 5) | b;
+		sptr += 4;
+	}
+}
+
+static void conv_greyf_grey8(void *dest, void *src, int count)
+{
+	float_to_byte(dest, src, count);
+}
+
+static void conv_rgbf_rgb24(void *dest, void *src, int count)
+{
+	float_to_byte(dest, src, count * 3);
+}
+
+static void conv_rgbaf_rgba32(void *dest, void *src, int count)
+{
+	float_to_byte(dest, src, count * 4);
+}
+
+static void float_to_byte_c(unsigned char *dest, float *src, int count)
+{
+	int i;
+
+	for(i=0; i<count; i++) {
+		int val = (int)(*src++ * 255.0);
+		*dest++ = CLAMP(val, 0, 255);
+	}
+}
+
+#ifdef FASTCONV_X86
+/* four RGB24 pixels at a time as 32bit words, little endian only */
+static void conv_rgb24_rgba32_word(void *dest, void *src, int count)
+{
+	uint32_t w[3], *dptr = dest;
+	unsigned char *sptr = src;
+
+	while(count >= 4) {
+		memcpy(w, sptr, sizeof w);
+		dptr[0] = w[0] | 0xff000000;
+		dptr[1] = (w[0] >> 24) | (w[1] << 8) | 0xff000000;
+		dptr[2] = (w[1] >> 16) | (w[2] << 16) | 0xff000000;
+		dptr[3] = (w[2] >> 8) | 0xff000000;
+		sptr += 12;
+		dptr += 4;
+		count -= 4;
+	}
+	conv_rgb24_rgba32(dptr, sptr, count);
+}
+
+static TARGET("sse2") void conv_grey8_rgba32_sse2(void *dest, void *src, int count)
+{
+	unsigned char *sptr = src;
+	__m128i *dptr = dest;
+	__m128i g, gg, ga, alpha = _mm_set1_epi8(-1);
+
+	while(count >= 16) {
+		g = _mm_loadu_si128((__m128i*)sptr);
+		gg = _mm_unpacklo_epi8(g, g);
+		ga = _mm_unpacklo_epi8(g, alpha);
+		_mm_storeu_si128(dptr, _mm_unpacklo_epi16(gg, ga));
+		_mm_storeu_si128(dptr + 1, _mm_unpackhi_epi16(gg, ga));
+		gg = _mm_unpackhi_epi8(g, g);
+		ga = _mm_unpackhi_epi8(g, alpha);
+		_mm_storeu_si128(dptr + 2, _mm_unpacklo_epi16(gg, ga));
+		_mm_storeu_si128(dptr + 3, _mm_unpackhi_epi16(gg, ga));
+		sptr += 16;
+		dptr += 4;
+		count -= 16;
+	}
+	conv_grey8_rgba32(dptr, sptr, count);
+}
+
+static TARGET("sse2") void conv_bgra32_rgba32_sse2(void *dest, void *src, int count)
+{
+	__m128i *sptr = src, *dptr = dest;
+	__m128i v, rb, mask_ag = _mm_set1_epi32(0xff00ff00), mask_rb = _mm_set1_epi32(0x00ff00ff);
+
+	while(count >= 4) {
+		v = _mm_loadu_si128(sptr++);
+		rb = _mm_and_si128(v, mask_rb);
+		rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+		_mm_storeu_si128(dptr++, _mm_or_si128(_mm_and_si128(v, mask_ag), rb));
+		count -= 4;
+	}
+	conv_bgra32_rgba32(dptr, sptr, count);
+}
+
+/* x / 255 for 0 <= x < 65535 */
+#define DIV255_SSE2(x) \
+	_mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, _mm_set1_epi16(1)), _mm_srli_epi16(x, 8)), 8)
+
+static TARGET("sse2") void conv_rgba32_rgb565_sse2(void *dest, void *src, int count)
+{
+	__m128i *sptr = src, *dptr = dest;
+	__m128i v0, v1, r, g, b, mask = _mm_set1_epi32(0xff);
+
+	while(count >= 8) {
+		v0 = _mm_loadu_si128(sptr++);
+		v1 = _mm_loadu_si128(sptr++);
+		r = _mm_packs_epi32(_mm_and_si128(v0, mask), _mm_and_si128(v1, mask));
+		g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(v0, 8), mask),
+				_mm_and_si128(_mm_srli_epi32(v1, 8), mask));
+		b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(v0, 16), mask),
+				_mm_and_si128(_mm_srli_epi32(v1, 16), mask));
+		r = _mm_mullo_epi16(r, _mm_set1_epi16(31));
+		g = _mm_mullo_epi16(g, _mm_set1_epi16(63));
+		b = _mm_mullo_epi16(b, _mm_set1_epi16(31));
+		r = _mm_slli_epi16(DIV255_SSE2(r), 11);
+		g = _mm_slli_epi16(DIV255_SSE2(g), 5);
+		b = DIV255_SSE2(b);
+		_mm_storeu_si128(dptr++, _mm_or_si128(_mm_or_si128(r, g), b));
+		count -= 8;
+	}
+	conv_rgba32_rgb565(dptr, sptr, count);
+}
+
+static TARGET("sse2") void float_to_byte_sse2(unsigned char *dest, float *src, int count)
+{
+	__m128 scale = _mm_set1_ps(255.0f);
+	__m128i a, b, c, d;
+
+	/* out of range values saturate in the packs, like CLAMP */
+	while(count >= 16) {
+		a = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src), scale));
+		b = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + 4), scale));
+		c = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + 8), scale));
+		d = _mm_cvttps_epi32(_mm_mul_ps(_mm_loadu_ps(src + 12), scale));
+		a = _mm_packs_epi32(a, b);
+		c = _mm_packs_epi32(c, d);
+		_mm_storeu_si128((__m128i*)dest, _mm_packus_epi16(a, c));
+		src += 16;
+		dest += 16;
+		count -= 16;
+	}
+	float_to_byte_c(dest, src, count);
+}
+
+static TARGET("avx2") void conv_grey8_rgba32_avx2(void *dest, void *src, int count)
+{
+	unsigned char *sptr = src;
+	__m256i *dptr = dest;
+	__m256i v, mul = _mm256_set1_epi32(0x010101), alpha = _mm256_set1_epi32(0xff000000);
+
+	while(count >= 8) {
+		v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)sptr));
+		_mm256_storeu_si256(dptr++, _mm256_or_si256(_mm256_mullo_epi32(v, mul), alpha));
+		sptr += 8;
+		count -= 8;
+	}
+	conv_grey8_rgba32(dptr, sptr, count);
+}
+
+static TARGET("avx2") void conv_rgb24_rgba32_avx2(void *dest, void *src, int count)
+{
+	unsigned char *sptr = src;
+	__m256i *dptr = dest;
+	__m256i v, alpha = _mm256_set1_epi32(0xff000000);
+	__m256i shuf = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+			0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+
+	/* each half is a 16 byte load of 4 pixels, so the second one reads 4
+	 * bytes past the 8 pixels converted, which must exist
+	 */
+	while(count >= 10) {
+		v = _mm256_castsi128_si256(_mm_loadu_si128((__m128i*)sptr));
+		v = _mm256_inserti128_si256(v, _mm_loadu_si128((__m128i*)(sptr + 12)), 1);
+		_mm256_storeu_si256(dptr++, _mm256_or_si256(_mm256_shuffle_epi8(v, shuf), alpha));
+		sptr += 24;
+		count -= 8;
+	}
+	conv_rgb24_rgba32_word(dptr, sptr, count);
+}
+
+static TARGET("avx2") void conv_bgra32_rgba32_avx2(void *dest, void *src, int count)
+{
+	__m256i *sptr = src, *dptr = dest;
+	__m256i shuf = _mm256_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+			2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+
+	while(count >= 8) {
+		_mm256_storeu_si256(dptr++, _mm256_shuffle_epi8(_mm256_loadu_si256(sptr++), shuf));
+		count -= 8;
+	}
+	conv_bgra32_rgba32(dptr, sptr, count);
+}
+#endif	/* FASTCONV_X86 */
+
+#ifdef FASTCONV_NEON
+static void conv_grey8_rgba32_neon(void *dest, void *src, int count)
+{
+	unsigned char *sptr = src, *dptr = dest;
+	uint8x16x4_t rgba;
+
+	rgba.val[3] = vdupq_n_u8(255);
+	while(count >= 16) {
+		rgba.val[0] = rgba.val[1] = rgba.val[2] = vld1q_u8(sptr);
+		vst4q_u8(dptr, rgba);
+		sptr += 16;
+		dptr += 64;
+		count -= 16;
+	}
+	conv_grey8_rgba32(dptr, sptr, count);
+}
+
+static void conv_rgb24_rgba32_neon(void *dest, void *src, int count)
+{
+	unsigned char *sptr = src, *dptr = dest;
+	uint8x16x3_t rgb;
+	uint8x16x4_t rgba;
+
+	rgba.val[3] = vdupq_n_u8(255);
+	while(count >= 16) {
+		rgb = vld3q_u8(sptr);
+		rgba.val[0] = rgb.val[0];
+		rgba.val[1] = rgb.val[1];
+		rgba.val[2] = rgb.val[2];
+		vst4q_u8(dptr, rgba);
+		sptr += 48;
+		dptr += 64;
+		count -= 16;
+	}
+	conv_rgb24_rgba32(dptr, sptr, count);
+}
+
+static void conv_bgra32_rgba32_neon(void *dest, void *src, int count)
+{
+	unsigned char *sptr = src, *dptr = dest;
+	uint8x16x4_t v;
+	uint8x16_t tmp;
+
+	while(count >= 16) {
+		v = vld4q_u8(sptr);
+		tmp = v.val[0];
+		v.val[0] = v.val[2];
+		v.val[2] = tmp;
+		vst4q_u8(dptr, v);
+		sptr += 64;
+		dptr += 64;
+		count -= 16;
+	}
+	conv_bgra32_rgba32(dptr, sptr, count);
+}
+
+/* x / 255 for 0 <= x < 65535 */
+#define DIV255_NEON(x) \
+	vshrq_n_u16(vaddq_u16(vaddq_u16(x, vdupq_n_u16(1)), vshrq_n_u16(x, 8)), 8)
+
+static void conv_rgba32_rgb565_neon(void *dest, void *src, int count)
+{
+	unsigned char *sptr = src;
+	uint16_t *dptr = dest;
+	uint8x8x4_t v;
+	uint16x8_t r, g, b;
+
+	while(count >= 8) {
+		v = vld4_u8(sptr);
+		r = vmull_u8(v.val[0], vdup_n_u8(31));
+		g = vmull_u8(v.val[1], vdup_n_u8(63));
+		b = vmull_u8(v.val[2], vdup_n_u8(31));
+		r = vshlq_n_u16(DIV255_NEON(r), 11);
+		g = vshlq_n_u16(DIV255_NEON(g), 5);
+		b = DIV255_NEON(b);
+		vst1q_u16(dptr, vorrq_u16(vorrq_u16(r, g), b));
+		sptr += 32;
+		dptr += 8;
+		count -= 8;
+	}
+	conv_rgba32_rgb565(dptr, sptr, count);
+}
+
+static void float_to_byte_neon(unsigned char *dest, float *src, int count)
+{
+	uint32x4_t a, b, c, d;
+	uint16x8_t lo, hi;
+
+	/* the float to unsigned conversion saturates negative values to 0 */
+	while(count >= 16) {
+		a = vcvtq_u32_f32(vmulq_n_f32(vld1q_f32(src), 255.0f));
+		b = vcvtq_u32_f32(vmulq_n_f32(vld1q_f32(src + 4), 255.0f));
+		c = vcvtq_u32_f32(vmulq_n_f32(vld1q_f32(src + 8), 255.0f));
+		d = vcvtq_u32_f32(vmulq_n_f32(vld1q_f32(src + 12), 255.0f));
+		lo = vcombine_u16(vqmovn_u32(a), vqmovn_u32(b));
+		hi = vcombine_u16(vqmovn_u32(c), vqmovn_u32(d));
+		vst1q_u8(dest, vcombine_u8(vqmovn_u16(lo), vqmovn_u16(hi)));
+		src += 16;
+		dest += 16;
+		count -= 16;
+	}
+	float_to_byte_c(dest, src, count);
+}
+#endif	/* FASTCONV_NEON */
+
+
+/* ---- RGBE decoding kernels ----
+ * The SIMD variants convert 4 or 8 pixels at a time, with the same operations
+ * in the same order as the scalar versions, which handle the rest, so results
+ * are identical. Values which overflow to NaN are tone mapped to 1.
+ */
+#define RGBE_CHUNK	256
+
+void img_rgbe_to_float(float *dest, const unsigned char *src, int count, int width, const float *scale)
+{
+	INIT_FASTCONV();
+	rgbe_to_float(dest, src, count, width, scale);
+}
+
+void img_rgbe_to_rgba(unsigned char *dest, const unsigned char *src, int count, int width,
+		const struct img_rgbe_conv *rc)
+{
+	INIT_FASTCONV();
+	rgbe_to_rgba(dest, src, count, width, rc);
+}
+
+static void rgbe_to_float_c(float *dest, const unsigned char *src, int count, int width, const float *scale)
+{
+	int i;
+	const unsigned char *r = src, *g = src + width, *b = src + width * 2, *e = src + width * 3;
+
+	for(i=0; i<count; i++) {
+		float f = scale[e[i]];
+		dest[0] = r[i] * f;
+		dest[1] = g[i] * f;
+		dest[2] = b[i] * f;
+		dest += 3;
+	}
+}
+
+/* tone maps through a buffer on the stack, in chunks of RGBE_CHUNK pixels,
+ * to let the compiler vectorize the operator loops
+ */
+static void rgbe_to_rgba_c(unsigned char *dest, const unsigned char *src, int count, int width,
+		const struct img_rgbe_conv *rc)
+{
+	int i, n, ridx = 0, bidx = 2;
+	int gmax = rc->gamma_size - 1;
+	float tmp[RGBE_CHUNK * 3], *fptr, v;
+
+	if(rc->bgra) {
+		ridx = 2;
+		bidx = 0;
+	}
+
+	while(count > 0) {
+		n = count < RGBE_CHUNK ? count : RGBE_CHUNK;
+		rgbe_to_float_c(tmp, src, n, width, rc->scale);
+
+		switch(rc->tonemap) {
+		case IMG_TONEMAP_REINHARD:
+			for(i=0; i<n * 3; i++) {
+				v = tmp[i] / (1.0f + tmp[i]);
+				tmp[i] = v < 1.0f ? v : 1.0f;
+			}
+			break;
+
+		case IMG_TONEMAP_ACES:
+			for(i=0; i<n * 3; i++) {
+				v = tmp[i];
+				v = (v * (2.51f * v + 0.03f)) / (v * (2.43f * v + 0.59f) + 0.14f);
+				tmp[i] = v < 1.0f ? v : 1.0f;
+			}
+			break;
+
+		default:
+			for(i=0; i<n * 3; i++) {
+				tmp[i] = tmp[i] < 1.0f ? tmp[i] : 1.0f;
+			}
+		}
+
+		fptr = tmp;
+		if(rc->tonemap == IMG_TONEMAP_CLAMP) {
+			/* linear, truncated like the img_convert float conversion */
+			for(i=0; i<n; i++) {
+				dest[ridx] = (int)(fptr[0] * 255.0);
+				dest[1] = (int)(fptr[1] * 255.0);
+				dest[bidx] = (int)(fptr[2] * 255.0);
+				dest[3] = 255;
+				fptr += 3;
+				dest += 4;
+			}
+		} else {
+			for(i=0; i<n; i++) {
+				dest[ridx] = rc->gamma[(int)(fptr[0] * gmax + 0.5f)];
+				dest[1] = rc->gamma[(int)(fptr[1] * gmax + 0.5f)];
+				dest[bidx] = rc->gamma[(int)(fptr[2] * gmax + 0.5f)];
+				dest[3] = 255;
+				fptr += 3;
+				dest += 4;
+			}
+		}
+		src += n;
+		count -= n;
+	}
+}
+
+#ifdef FASTCONV_X86
+/* four bytes of a channel, to floats */
+#define LOAD4_SSE2(p) \
+	_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(load32(p)), \
+					_mm_setzero_si128()), _mm_setzero_si128()))
+/* eight bytes of a channel, to floats */
+#define LOAD8_AVX2(p) \
+	_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(p))))
+
+static int32_t load32(const unsigned char *p)
+{
+	int32_t v;
+	memcpy(&v, p, sizeof v);
+	return v;
+}
+
+/* stores four RGB pixels from separate channel vectors */
+static TARGET("sse2") void store_rgb_sse2(float *dest, __m128 r, __m128 g, __m128 b)
+{
+	__m128 rg_lo = _mm_unpacklo_ps(r, g), rg_hi = _mm_unpackhi_ps(r, g);
+	__m128 br_lo = _mm_unpacklo_ps(b, r), br_hi = _mm_unpackhi_ps(b, r);
+	__m128 gb_lo = _mm_unpacklo_ps(g, b), gb_hi = _mm_unpackhi_ps(g, b);
+
+	_mm_storeu_ps(dest, _mm_shuffle_ps(rg_lo, br_lo, _MM_SHUFFLE(3, 0, 1, 0)));
+	_mm_storeu_ps(dest + 4, _mm_shuffle_ps(gb_lo, rg_hi, _MM_SHUFFLE(1, 0, 3, 2)));
+	_mm_storeu_ps(dest + 8, _mm_shuffle_ps(br_hi, gb_hi, _MM_SHUFFLE(3, 2, 3, 0)));
+}
+
+/* min returns its second operand for NaNs, which maps them to 1 */
+static TARGET("sse2") __m128 tonemap_sse2(__m128 x, int op)
+{
+	__m128 one = _mm_set1_ps(1.0f);
+
+	switch(op) {
+	case IMG_TONEMAP_REINHARD:
+		x = _mm_div_ps(x, _mm_add_ps(one, x));
+		break;
+
+	case IMG_TONEMAP_ACES:
+		x = _mm_div_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.51f), x), _mm_set1_ps(0.03f))),
+				_mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(_mm_set1_ps(2.43f), x),
+							_mm_set1_ps(0.59f))), _mm_set1_ps(0.14f)));
+		break;
+
+	default:
+		break;
+	}
+	return _mm_min_ps(x, one);
+}
+
+/* (int)(x * 255.0), in double precision like the scalar version */
+static TARGET("sse2") __m128i to_byte_sse2(__m128 x)
+{
+	__m128d scale = _mm_set1_pd(255.0);
+	__m128i lo = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(x), scale));
+	__m128i hi = _mm_cvttpd_epi32(_mm_mul_pd(_mm_cvtps_pd(_mm_movehl_ps(x, x)), scale));
+	return _mm_unpacklo_epi64(lo, hi);
+}
+
+static TARGET("sse2") void rgbe_to_float_sse2(float *dest, const unsigned char *src, int count,
+		int width, const float *scale)
+{
+	const unsigned char *r = src, *g = src + width, *b = src + width * 2, *e = src + width * 3;
+	__m128 f;
+	int i;
+
+	for(i=0; i<=count - 4; i+=4) {
+		f = _mm_setr_ps(scale[e[i]], scale[e[i + 1]], scale[e[i + 2]], scale[e[i + 3]]);
+		store_rgb_sse2(dest, _mm_mul_ps(LOAD4_SSE2(r + i), f), _mm_mul_ps(LOAD4_SSE2(g + i), f),
+				_mm_mul_ps(LOAD4_SSE2(b + i), f));
+		dest += 12;
+	}
+	rgbe_to_float_c(dest, src + i, count - i, width, scale);
+}
+
+static TARGET("sse2") void rgbe_to_rgba_sse2(unsigned char *dest, const unsigned char *src, int count,
+		int width, const struct img_rgbe_conv *rc)
+{
+	const unsigned char *r = src, *g = src + width, *b = src + width * 2, *e = src + width * 3;
+	const float *scale = rc->scale;
+	__m128 f, vr, vg, vb, gscale, half;
+	__m128i ir, ig, ib, alpha = _mm_set1_epi32(0xff000000);
+	int i, j, ridx[4], gidx[4], bidx[4];
+
+	if(rc->bgra) {
+		r = src + width * 2;
+		b = src;
+	}
+	gscale = _mm_set1_ps((float)(rc->gamma_size - 1));
+	half = _mm_set1_ps(0.5f);
+
+	for(i=0; i<=count - 4; i+=4) {
+		f = _mm_setr_ps(scale[e[i]], scale[e[i + 1]], scale[e[i + 2]], scale[e[i + 3]]);
+		vr = tonemap_sse2(_mm_mul_ps(LOAD4_SSE2(r + i), f), rc->tonemap);
+		vg = tonemap_sse2(_mm_mul_ps(LOAD4_SSE2(g + i), f), rc->tonemap);
+		vb = tonemap_sse2(_mm_mul_ps(LOAD4_SSE2(b + i), f), rc->tonemap);
+
+		if(rc->tonemap == IMG_TONEMAP_CLAMP) {
+			ir = to_byte_sse2(vr);
+			ig = _mm_slli_epi32(to_byte_sse2(vg), 8);
+			ib = _mm_slli_epi32(to_byte_sse2(vb), 16);
+			_mm_storeu_si128((__m128i*)dest, _mm_or_si128(_mm_or_si128(ir, ig), _mm_or_si128(ib, alpha)));
+		} else {
+			/* no byte gathers, the gamma table is looked up per channel */
+			_mm_storeu_si128((__m128i*)ridx, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(vr, gscale), half)));
+			_mm_storeu_si128((__m128i*)gidx, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(vg, gscale), half)));
+			_mm_storeu_si128((__m128i*)bidx, _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(vb, gscale), half)));
+			for(j=0; j<4; j++) {
+				dest[j * 4] = rc->gamma[ridx[j]];
+				dest[j * 4 + 1] = rc->gamma[gidx[j]];
+				dest[j * 4 + 2] = rc->gamma[bidx[j]];
+				dest[j * 4 + 3] = 255;
+			}
+		}
+		dest += 16;
+	}
+	rgbe_to_rgba_c(dest, src + i, count - i, width, rc);
+}
+
+static TARGET("avx2") __m256 tonemap_avx2(__m256 x, int op)
+{
+	__m256 one = _mm256_set1_ps(1.0f);
+
+	switch(op) {
+	case IMG_TONEMAP_REINHARD:
+		x = _mm256_div_ps(x, _mm256_add_ps(one, x));
+		break;
+
+	case IMG_TONEMAP_ACES:
+		x = _mm256_div_ps(_mm256_mul_ps(x, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(2.51f), x),
+						_mm256_set1_ps(0.03f))),
+				_mm256_add_ps(_mm256_mul_ps(x, _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(2.43f), x),
+							_mm256_set1_ps(0.59f))), _mm256_set1_ps(0.14f)));
+		break;
+
+	default:
+		break;
+	}
+	return _mm256_min_ps(x, one);
+}
+
+static TARGET("avx2") __m256i to_byte_avx2(__m256 x)
+{
+	__m256d scale = _mm256_set1_pd(255.0);
+	__m128i lo = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_cvtps_pd(_mm256_castps256_ps128(x)), scale));
+	__m128i hi = _mm256_cvttpd_epi32(_mm256_mul_pd(_mm256_cvtps_pd(_mm256_extractf128_ps(x, 1)), scale));
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+}
+
+static TARGET("avx2") void rgbe_to_float_avx2(float *dest, const unsigned char *src, int count,
+		int width, const float *scale)
+{
+	const unsigned char *r = src, *g = src + width, *b = src + width * 2, *e = src + width * 3;
+	__m256 f, vr, vg, vb;
+	int i;
+
+	for(i=0; i<=count - 8; i+=8) {
+		f = _mm256_i32gather_ps(scale, _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(e + i))), 4);
+		vr = _mm256_mul_ps(LOAD8_AVX2(r + i), f);
+		vg = _mm256_mul_ps(LOAD8_AVX2(g + i), f);
+		vb = _mm256_mul_ps(LOAD8_AVX2(b + i), f);
+		store_rgb_sse2(dest, _mm256_castps256_ps128(vr), _mm256_castps256_ps128(vg),
+				_mm256_castps256_ps128(vb));
+		store_rgb_sse2(dest + 12, _mm256_extractf128_ps(vr, 1), _mm256_extractf128_ps(vg, 1),
+				_mm256_extractf128_ps(vb, 1));
+		dest += 24;
+	}
+	rgbe_to_float_c(dest, src + i, count - i, width, scale);
+}
+
+static TARGET("avx2") void rgbe_to_rgba_avx2(unsigned char *dest, const unsigned char *src, int count,
+		int width, const struct img_rgbe_conv *rc)
+{
+	const unsigned char *r = src, *g = src + width, *b = src + width * 2, *e = src + width * 3;
+	__m256 f, vr, vg, vb, gscale, half;
+	__m256i ir, ig, ib, alpha = _mm256_set1_epi32(0xff000000);
+	int i, j, ridx[8], gidx[8], bidx[8];
+
+	if(rc->bgra) {
+		r = src + width * 2;
+		b = src;
+	}
+	gscale = _mm256_set1_ps((float)(rc->gamma_size - 1));
+	half = _mm256_set1_ps(0.5f);
+
+	for(i=0; i<=count - 8; i+=8) {
+		f = _mm256_i32gather_ps(rc->scale, _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(e + i))), 4);
+		vr = tonemap_avx2(_mm256_mul_ps(LOAD8_AVX2(r + i), f), rc->tonemap);
+		vg = tonemap_avx2(_mm256_mul_ps(LOAD8_AVX2(g + i), f), rc->tonemap);
+		vb = tonemap_avx2(_mm256_mul_ps(LOAD8_AVX2(b + i), f), rc->tonemap);
+
+		if(rc->tonemap == IMG_TONEMAP_CLAMP) {
+			ir = to_byte_avx2(vr);
+			ig = _mm256_slli_epi32(to_byte_avx2(vg), 8);
+			ib = _mm256_slli_epi32(to_byte_avx2(vb), 16);
+			_mm256_storeu_si256((__m256i*)dest, _mm256_or_si256(_mm256_or_si256(ir, ig),
+						_mm256_or_si256(ib, alpha)));
+		} else {
+			_mm256_storeu_si256((__m256i*)ridx, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(vr, gscale), half)));
+			_mm256_storeu_si256((__m256i*)gidx, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(vg, gscale), half)));
+			_mm256_storeu_si256((__m256i*)bidx, _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(vb, gscale), half)));
+			for(j=0; j<8; j++) {
+				dest[j * 4] = rc->gamma[ridx[j]];
+				dest[j * 4 + 1] = rc->gamma[gidx[j]];
+				dest[j * 4 + 2] = rc->gamma[bidx[j]];
+				dest[j * 4 + 3] = 255;
+			}
+		}
+		dest += 32;
+	}
+	rgbe_to_rgba_c(dest, src + i, count - i, width, rc);
+}
+#endif	/* FASTCONV_X86 */
+
+/* picks the best kernels supported by the CPU we're running on */
+static void init_fastconv(void)
+{
+#ifdef FASTCONV_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sse2")) {
+		set_fastconv(IMG_FMT_GREY8, IMG_FMT_RGBA32, conv_grey8_rgba32_sse2);
+		set_fastconv(IMG_FMT_RGB24, IMG_FMT_RGBA32, conv_rgb24_rgba32_word);
+		set_fastconv(IMG_FMT_BGRA32, IMG_FMT_RGBA32, conv_bgra32_rgba32_sse2);
+		set_fastconv(IMG_FMT_RGBA32, IMG_FMT_BGRA32, conv_bgra32_rgba32_sse2);
+		set_fastconv(IMG_FMT_RGBA32, IMG_FMT_RGB565, conv_rgba32_rgb565_sse2);
+		float_to_byte = float_to_byte_sse2;
+		rgbe_to_float = rgbe_to_float_sse2;
+		rgbe_to_rgba = rgbe_to_rgba_sse2;
+	}
+	if(__builtin_cpu_supports("avx2")) {
+		set_fastconv(IMG_FMT_GREY8, IMG_FMT_RGBA32, conv_grey8_rgba32_avx2);
+		set_fastconv(IMG_FMT_RGB24, IMG_FMT_RGBA32, conv_rgb24_rgba32_avx2);
+		set_fastconv(IMG_FMT_BGRA32, IMG_FMT_RGBA32, conv_bgra32_rgba32_avx2);
+		set_fastconv(IMG_FMT_RGBA32, IMG_FMT_BGRA32, conv_bgra32_rgba32_avx2);
+		rgbe_to_float = rgbe_to_float_avx2;
+		rgbe_to_rgba = rgbe_to_rgba_avx2;
+	}
+#endif
+#ifdef FASTCONV_NEON
+	set_fastconv(IMG_FMT_GREY8, IMG_FMT_RGBA32, conv_grey8_rgba32_neon);
+	set_fastconv(IMG_FMT_RGB24, IMG_FMT_RGBA32, conv_rgb24_rgba32_neon);
+	set_fastconv(IMG_FMT_BGRA32, IMG_FMT_RGBA32, conv_bgra32_rgba32_neon);
+	set_fastconv(IMG_FMT_RGBA32, IMG_FMT_BGRA32, conv_bgra32_rgba32_neon);
+	set_fastconv(IMG_FMT_RGBA32, IMG_FMT_RGB565, conv_rgba32_rgb565_neon);
+	float_to_byte = float_to_byte_neon;
+#endif
+}
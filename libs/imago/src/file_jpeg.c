@@ -31,10 +31,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <jpeglib.h>
 #include "imago2.h"
 #include "ftype_module.h"
+#include "threads.h"
+#include "stream.h"
 
 #define INPUT_BUF_SIZE	512
 #define OUTPUT_BUF_SIZE	512
 
+/* the size of a dimension after scaling by 1/denom, as computed by libjpeg */
+#define SCALED(x, denom)	(((x) + (denom) - 1) / (denom))
+
 /* data source manager: adapted from jdatasrc.c */
 struct src_mgr {
 	struct jpeg_source_mgr pub;
@@ -52,8 +57,14 @@ struct dst_mgr {
 	unsigned char buffer[OUTPUT_BUF_SIZE];
 };
 
-static int check(struct img_io *io);
 static int read(struct img_pixmap *img, struct img_io *io);
+static int read_ex(struct img_pixmap *img, struct img_io *io, const struct img_load_opt *opt);
+static int read_stream(struct img_io *io, const struct img_load_opt *opt, const struct img_stream *st);
+static int decode(struct img_pixmap *img, const struct img_stream *st, struct img_io *io,
+		const struct img_load_opt *opt);
+static int decode_rows(struct jpeg_decompress_struct *cinfo, enum img_fmt fmt, int expand,
+		int width, int height, int out_fmt, const struct img_stream *st);
+static void expand_rgb(unsigned char *row, int width, int bgra);
 static int write(struct img_pixmap *img, struct img_io *io);
 
 /* read source functions */
@@ -69,41 +80,47 @@ static void term_destination(j_compress_ptr jc);
 
 int img_register_jpeg(void)
 {
-	static struct ftype_module mod = {".jpg:.jpeg", check, read, write};
+	static struct ftype_signature sig[] = {
+		{0, 3, "\xff\xd8\xff"},	/* SOI followed by any marker */
+		{0}
+	};
+	static struct ftype_module mod = {".jpg:.jpeg", sig, 0, read, write, read_ex, read_stream};
 	return img_register_module(&mod);
 }
 
 
-static int check(struct img_io *io)
+static int read(struct img_pixmap *img, struct img_io *io)
 {
-	unsigned char sig[10];
-
-	long pos = io->seek(0, SEEK_CUR, io->uptr);
+	return read_ex(img, io, 0);
+}
 
-	if(io->read(sig, 10, io->uptr) < 10) {
-		io->seek(pos, SEEK_SET, io->uptr);
-		return -1;
-	}
+static int read_ex(struct img_pixmap *img, struct img_io *io, const struct img_load_opt *opt)
+{
+	return decode(img, 0, io, opt);
+}
 
-	if(memcmp(sig, "\xff\xd8\xff\xe0", 4) != 0 && memcmp(sig, "\xff\xd8\xff\xe1", 4) != 0
-			&& memcmp(sig, "\xff\xd8\xff\xdb", 4) != 0 && memcmp(sig + 6, "JFIF", 4) != 0) {
-		io->seek(pos, SEEK_SET, io->uptr);
-		return -1;
-	}
-	io->seek(pos, SEEK_SET, io->uptr);
-	return 0;
+static int read_stream(struct img_io *io, const struct img_load_opt *opt, const struct img_stream *st)
+{
+	return decode(0, st, io, opt);
 }
 
-static int read(struct img_pixmap *img, struct img_io *io)
+/* Decodes into img, or passes the rows to st if img is null. Images decoded to
+ * a pixmap at the size libjpeg produces are decoded straight into it. Otherwise
+ * they're decoded a band at a time, and fed to a row stream, which resamples
+ * them to the target size, so the whole decoded image is never in memory.
+ */
+static int decode(struct img_pixmap *img, const struct img_stream *st, struct img_io *io,
+		const struct img_load_opt *opt)
 {
-	int i, nlines = 0;
+	int i, nlines = 0, width = 0, height = 0;
+	int expand = 0, res;
+	struct img_stream pixst;
+	enum img_fmt fmt = IMG_FMT_RGB24;
 	struct jpeg_decompress_struct cinfo;
 	struct jpeg_error_mgr jerr;
 	struct src_mgr src;
 	unsigned char **scanlines;
 
-	io->seek(0, SEEK_CUR, io->uptr);
-
 	cinfo.err = jpeg_std_error(&jerr);	/* XXX change... */
 	jpeg_create_decompress(&cinfo);
 
@@ -115,12 +132,69 @@ static int read(struct img_pixmap *img, struct img_io *io)
 	src.pub.next_input_byte = 0;
 	src.pub.bytes_in_buffer = 0;
 	src.io = io;
+	if(io->data) {
+		/* decode in place, fill_input_buffer is only called past the end */
+		long pos = io->seek(0, SEEK_CUR, io->uptr);
+		src.pub.next_input_byte = io->data + pos;
+		src.pub.bytes_in_buffer = io->size - pos;
+		io->seek(0, SEEK_END, io->uptr);
+	}
 	cinfo.src = (struct jpeg_source_mgr*)&src;
 
 	jpeg_read_header(&cinfo, 1);
 	cinfo.out_color_space = JCS_RGB;
 
-	if(img_set_pixels(img, cinfo.image_width, cinfo.image_height, IMG_FMT_RGB24, 0) == -1) {
+	/* decode straight into the requested 32bit format. libjpeg-turbo can
+	 * output it directly, otherwise each scanline is expanded in place.
+	 */
+	if(opt && (opt->fmt == IMG_FMT_RGBA32 || opt->fmt == IMG_FMT_BGRA32)) {
+		fmt = opt->fmt;
+#ifdef JCS_ALPHA_EXTENSIONS
+		cinfo.out_color_space = fmt == IMG_FMT_RGBA32 ? JCS_EXT_RGBA : JCS_EXT_BGRA;
+#else
+		expand = 1;
+#endif
+	}
+
+	/* let libjpeg skip most of the IDCT work by decoding at the largest power of
+	 * two reduction (up to 1/8) which still covers the target size, and leave
+	 * the rest to the area filter
+	 */
+	if(opt && opt->target_size) {
+		width = cinfo.image_width;
+		height = cinfo.image_height;
+		opt->target_size(cinfo.image_width, cinfo.image_height, &width, &height, opt->cls);
+		if(width > 0 && height > 0) {
+			cinfo.scale_num = 1;
+			cinfo.scale_denom = 8;
+			while(cinfo.scale_denom > 1 && ((int)SCALED(cinfo.image_width, cinfo.scale_denom) < width ||
+						(int)SCALED(cinfo.image_height, cinfo.scale_denom) < height)) {
+				cinfo.scale_denom >>= 1;
+			}
+		}
+	}
+	if(opt && opt->preview) {
+		cinfo.dct_method = JDCT_IFAST;
+		cinfo.do_fancy_upsampling = 0;
+	}
+	jpeg_calc_output_dimensions(&cinfo);
+
+	if(width <= 0 || height <= 0) {
+		width = cinfo.output_width;
+		height = cinfo.output_height;
+	}
+
+	if(!img || width < (int)cinfo.output_width || height < (int)cinfo.output_height) {
+		if(!st) {
+			img_stream_pixmap(&pixst, img);
+			st = &pixst;
+		}
+		res = decode_rows(&cinfo, fmt, expand, width, height, opt ? opt->fmt : -1, st);
+		jpeg_destroy_decompress(&cinfo);
+		return res;
+	}
+
+	if(img_alloc_pixels(img, cinfo.output_width, cinfo.output_height, fmt) == -1) {
 		jpeg_destroy_decompress(&cinfo);
 		return -1;
 	}
@@ -137,15 +211,103 @@ static int read(struct img_pixmap *img, struct img_io *io)
 	jpeg_start_decompress(&cinfo);
 	while(nlines < img->height) {
 		int res = jpeg_read_scanlines(&cinfo, scanlines + nlines, img->height - nlines);
+		if(expand) {
+			for(i=0; i<res; i++) {
+				expand_rgb(scanlines[nlines + i], img->width, fmt == IMG_FMT_BGRA32);
+			}
+		}
 		nlines += res;
 	}
 	jpeg_finish_decompress(&cinfo);
 	jpeg_destroy_decompress(&cinfo);
 
 	free(scanlines);
+
+	if(opt && opt->fmt >= 0) {
+		return img_convert(img, opt->fmt);
+	}
 	return 0;
 }
 
+/* decodes a band of scanlines at a time, large enough for the resampler to
+ * filter in parallel, and pushes them through a row stream
+ */
+static int decode_rows(struct jpeg_decompress_struct *cinfo, enum img_fmt fmt, int expand,
+		int width, int height, int out_fmt, const struct img_stream *st)
+{
+	int i, n, res = -1, band_rows;
+	long rowsz = cinfo->output_width * img_fmt_pixel_size(fmt);
+	unsigned char *band = 0, **scanlines = 0;
+	struct img_rowstream *rs;
+
+	band_rows = (IMG_MT_THRESHOLD + cinfo->output_width - 1) / cinfo->output_width;
+	if(band_rows < cinfo->rec_outbuf_height) band_rows = cinfo->rec_outbuf_height;
+	if(band_rows > (int)cinfo->output_height) band_rows = cinfo->output_height;
+
+	if(!(band = malloc(band_rows * rowsz)) || !(scanlines = malloc(band_rows * sizeof *scanlines))) {
+		goto end;
+	}
+	for(i=0; i<band_rows; i++) {
+		scanlines[i] = band + i * rowsz;
+	}
+
+	if(!(rs = img_rowstream_begin(cinfo->output_width, cinfo->output_height, fmt, width,
+					height, out_fmt, st))) {
+		goto end;
+	}
+
+	jpeg_start_decompress(cinfo);
+	while(cinfo->output_scanline < cinfo->output_height) {
+		n = 0;
+		while(n < band_rows && cinfo->output_scanline < cinfo->output_height) {
+			if((i = jpeg_read_scanlines(cinfo, scanlines + n, band_rows - n)) <= 0) {
+				break;
+			}
+			n += i;
+		}
+		if(expand) {
+			for(i=0; i<n; i++) {
+				expand_rgb(scanlines[i], cinfo->output_width, fmt == IMG_FMT_BGRA32);
+			}
+		}
+		if(!n || img_rowstream_push(rs, band, n) == -1) {
+			break;
+		}
+	}
+	if(cinfo->output_scanline >= cinfo->output_height) {
+		jpeg_finish_decompress(cinfo);
+	}
+	res = img_rowstream_end(rs);
+
+end:
+	free(scanlines);
+	free(band);
+	return res;
+}
+
+/* expands a scanline of RGB pixels at the start of row, to 32bit pixels.
+ * Works backwards, so that no pixel is overwritten before it's read.
+ */
+static void expand_rgb(unsigned char *row, int width, int bgra)
+{
+	int i;
+	unsigned char r, g, b;
+	unsigned char *src = row + (width - 1) * 3;
+	unsigned char *dest = row + (width - 1) * 4;
+
+	for(i=0; i<width; i++) {
+		r = src[0];
+		g = src[1];
+		b = src[2];
+		dest[0] = bgra ? b : r;
+		dest[1] = g;
+		dest[2] = bgra ? r : b;
+		dest[3] = 255;
+		src -= 3;
+		dest -= 4;
+	}
+}
+
 static int write(struct img_pixmap *img, struct img_io *io)
 {
 	int i, nlines = 0;
@@ -213,7 +375,7 @@ static int write(struct img_pixmap *img, struct img_io *io)
 static void init_source(j_decompress_ptr jd)
 {
 	struct src_mgr *src = (struct src_mgr*)jd->src;
-	src->start_of_file = 1;
+	src->start_of_file = src->pub.bytes_in_buffer == 0;
 }
 
 static boolean fill_input_buffer(j_decompress_ptr jd)
@@ -95,7 +95,6 @@ enum {
 };
 
 
-static int check_file(struct img_io *io);
 static int read_file(struct img_pixmap *img, struct img_io *io);
 static int write_file(struct img_pixmap *img, struct img_io *io);
 
@@ -116,32 +115,15 @@ static uint32_t swap32(uint32_t x);
 
 int img_register_lbm(void)
 {
-	static struct ftype_module mod = {".lbm:.ilbm:.iff", check_file, read_file, write_file };
+	static struct ftype_signature sig[] = {
+		{8, 4, "ILBM"},
+		{8, 4, "PBM "},
+		{0}
+	};
+	static struct ftype_module mod = {".lbm:.ilbm:.iff", sig, 0, read_file, write_file };
 	return img_register_module(&mod);
 }
 
-static int check_file(struct img_io *io)
-{
-	uint32_t type;
-	struct chdr hdr;
-	long pos = io->seek(0, SEEK_CUR, io->uptr);
-
-	while(read_header(io, &hdr) != -1) {
-		if(IS_IFF_CONTAINER(hdr.id)) {
-			type = img_read_uint32_be(io);
-			if(type == IFF_ILBM || type == IFF_PBM ) {
-				io->seek(pos, SEEK_SET, io->uptr);
-				return 0;
-			}
-			hdr.size -= sizeof type;	/* so we will seek fwd correctly */
-		}
-		io->seek(hdr.size, SEEK_CUR, io->uptr);
-	}
-
-	io->seek(pos, SEEK_SET, io->uptr);
-	return -1;
-}
-
 static int read_file(struct img_pixmap *img, struct img_io *io)
 {
 	uint32_t type;
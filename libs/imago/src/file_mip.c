@@ -0,0 +1,497 @@
+/*
+libimago - a multi-format image file input/output library.
+Copyright (C) 2010-2020 John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* -- mipmap container module -- */
+
+/* All fields are 32bit little endian:
+ *  0: magic "IMIP"
+ *  4: version (1)
+ *  8: width, height of level 0
+ * 16: pixel format (0: RGBA, 8 bits per channel)
+ * 20: number of levels
+ * 24: level table, for each level: width, height, offset and size of the level
+ *     data, and compression (0: none, 1: LZ4 block)
+ * Levels halve in size, rounding down, until they're 1x1, like OpenGL texture
+ * levels. Their data start at offsets aligned to LEVEL_ALIGN.
+ */
+#include <string.h>
+#include <stdlib.h>
+#include "imago2.h"
+#include "ftype_module.h"
+#include "threads.h"
+#include "stream.h"
+#include "lz4.h"
+
+#define MIP_VERSION		1
+#define HDR_SIZE		24
+#define LEVEL_SIZE		20
+#define MAX_LEVELS		32
+#define LEVEL_ALIGN		4096
+
+enum { COMP_NONE, COMP_LZ4 };
+
+static int read(struct img_pixmap *img, struct img_io *io);
+static int write(struct img_pixmap *img, struct img_io *io);
+static int read_ex(struct img_pixmap *img, struct img_io *io, const struct img_load_opt *opt);
+static int read_stream(struct img_io *io, const struct img_load_opt *opt, const struct img_stream *st);
+static int decode(struct img_pixmap *img, const struct img_stream *st, struct img_io *io,
+		const struct img_load_opt *opt);
+static struct img_miplevel *read_levels(struct img_io *io, int *num_levels);
+static int read_level(struct img_io *io, struct img_miplevel *lvl, unsigned char *dest);
+static int write_level(struct img_io *io, long pos, struct img_miplevel *lvl, void *data);
+static unsigned long get32(const unsigned char *p);
+static void put32(unsigned char *p, unsigned long val);
+
+
+int img_register_mip(void)
+{
+	static struct ftype_signature sig[] = {
+		{0, 4, "IMIP"},
+		{0}
+	};
+	static struct ftype_module mod = {".imip", sig, 0, read, write, read_ex, read_stream};
+	return img_register_module(&mod);
+}
+
+static int read(struct img_pixmap *img, struct img_io *io)
+{
+	return decode(img, 0, io, 0);
+}
+
+static int write(struct img_pixmap *img, struct img_io *io)
+{
+	return img_write_mipmap(img, io, 0);
+}
+
+static int read_ex(struct img_pixmap *img, struct img_io *io, const struct img_load_opt *opt)
+{
+	if(opt && opt->preview) {
+		return -1;
+	}
+	return decode(img, 0, io, opt);
+}
+
+static int read_stream(struct img_io *io, const struct img_load_opt *opt, const struct img_stream *st)
+{
+	if(opt && opt->preview) {
+		return -1;
+	}
+	return decode(0, st, io, opt);
+}
+
+/* Picks the smallest level at least as large as the target size, and copies
+ * it to img, or resamples it to the target size through a row stream.
+ */
+static int decode(struct img_pixmap *img, const struct img_stream *st, struct img_io *io,
+		const struct img_load_opt *opt)
+{
+	int i, y, n, num_levels, width, height, band_rows, res = -1;
+	int want_fmt = opt ? opt->fmt : -1;
+	long pitch, pixsz;
+	unsigned char *buf = 0;
+	const unsigned char *src;
+	struct img_miplevel *levels, *lvl;
+	struct img_rowstream *rs;
+	struct img_stream pixst;
+
+	if(!(levels = read_levels(io, &num_levels))) {
+		return -1;
+	}
+
+	width = levels[0].width;
+	height = levels[0].height;
+	if(opt && opt->target_size) {
+		opt->target_size(levels[0].width, levels[0].height, &width, &height, opt->cls);
+		if(width <= 0 || height <= 0) {
+			width = levels[0].width;
+			height = levels[0].height;
+		}
+	}
+	lvl = levels;
+	for(i=1; i<num_levels; i++) {
+		if(levels[i].width < width || levels[i].height < height) break;
+		lvl = levels + i;
+	}
+	pitch = lvl->width * 4;
+	pixsz = pitch * lvl->height;
+
+	if(img && lvl->width <= width && lvl->height <= height) {
+		if(img_alloc_pixels(img, lvl->width, lvl->height, IMG_FMT_RGBA32) == -1 ||
+				read_level(io, lvl, img->pixels) == -1) {
+			goto end;
+		}
+		res = want_fmt >= 0 ? img_convert(img, want_fmt) : 0;
+		goto end;
+	}
+
+	/* uncompressed level data are streamed in place if the whole input is in memory */
+	if(!lvl->lz4 && io->data && lvl->offset + lvl->size <= io->size) {
+		src = io->data + lvl->offset;
+	} else {
+		if(!(buf = malloc(pixsz)) || read_level(io, lvl, buf) == -1) {
+			goto end;
+		}
+		src = buf;
+	}
+
+	if(!st) {
+		img_stream_pixmap(&pixst, img);
+		st = &pixst;
+	}
+	if(!(rs = img_rowstream_begin(lvl->width, lvl->height, IMG_FMT_RGBA32, width, height, want_fmt, st))) {
+		goto end;
+	}
+	band_rows = (IMG_MT_THRESHOLD + lvl->width - 1) / lvl->width;
+	for(y=0; y<lvl->height; y+=n) {
+		n = lvl->height - y < band_rows ? lvl->height - y : band_rows;
+		if(img_rowstream_push(rs, (void*)(src + y * pitch), n) == -1) {
+			img_rowstream_end(rs);
+			goto end;
+		}
+	}
+	res = img_rowstream_end(rs);
+
+end:
+	free(buf);
+	free(levels);
+	return res;
+}
+
+/* reads and validates the header and level table */
+static struct img_miplevel *read_levels(struct img_io *io, int *num_levels)
+{
+	int i, n;
+	unsigned long width, height, offs, size, comp, pixsz;
+	unsigned char hdr[HDR_SIZE], tab[MAX_LEVELS * LEVEL_SIZE], *ent;
+	struct img_miplevel *levels;
+
+	if(io->read(hdr, HDR_SIZE, io->uptr) < HDR_SIZE || memcmp(hdr, "IMIP", 4) != 0) {
+		return 0;
+	}
+	width = get32(hdr + 8);
+	height = get32(hdr + 12);
+	n = get32(hdr + 20);
+	if(get32(hdr + 4) != MIP_VERSION || get32(hdr + 16) != 0 || n < 1 || n > MAX_LEVELS ||
+			width < 1 || height < 1 || width > 0x7fffffff / 4 / height) {
+		return 0;
+	}
+	if(io->read(tab, n * LEVEL_SIZE, io->uptr) < (size_t)(n * LEVEL_SIZE)) {
+		return 0;
+	}
+	if(!(levels = malloc(n * sizeof *levels))) {
+		return 0;
+	}
+
+	for(i=0; i<n; i++) {
+		ent = tab + i * LEVEL_SIZE;
+		offs = get32(ent + 8);
+		size = get32(ent + 12);
+		comp = get32(ent + 16);
+		pixsz = width * height * 4;
+
+		if(get32(ent) != width || get32(ent + 4) != height || offs > 0x7fffffff || size > 0x7fffffff ||
+				(comp == COMP_NONE && size != pixsz) ||
+				(comp == COMP_LZ4 && (size < 1 || size > IMG_LZ4_BOUND(pixsz))) || comp > COMP_LZ4 ||
+				(io->data && (long)(offs + size) > io->size)) {
+			free(levels);
+			return 0;
+		}
+		levels[i].width = width;
+		levels[i].height = height;
+		levels[i].pixels = 0;
+		levels[i].offset = offs;
+		levels[i].size = size;
+		levels[i].lz4 = comp == COMP_LZ4;
+
+		if(width > 1) width >>= 1;
+		if(height > 1) height >>= 1;
+	}
+	if(levels[n - 1].width != 1 || levels[n - 1].height != 1) {
+		free(levels);	/* incomplete mipmap chain */
+		return 0;
+	}
+
+	*num_levels = n;
+	return levels;
+}
+
+/* reads the RGBA32 pixels of a level into dest, decompressing them if necessary */
+static int read_level(struct img_io *io, struct img_miplevel *lvl, unsigned char *dest)
+{
+	long pixsz = lvl->width * lvl->height * 4;
+	unsigned char *buf;
+	int res;
+
+	if(io->data && lvl->offset + lvl->size <= io->size) {
+		if(!lvl->lz4) {
+			memcpy(dest, io->data + lvl->offset, pixsz);
+			return 0;
+		}
+		return img_lz4_decompress(dest, pixsz, io->data + lvl->offset, lvl->size) == pixsz ? 0 : -1;
+	}
+
+	if(io->seek(lvl->offset, SEEK_SET, io->uptr) == -1) {
+		return -1;
+	}
+	if(!lvl->lz4) {
+		return io->read(dest, pixsz, io->uptr) < (size_t)pixsz ? -1 : 0;
+	}
+
+	if(!(buf = malloc(lvl->size))) {
+		return -1;
+	}
+	res = -1;
+	if(io->read(buf, lvl->size, io->uptr) == (size_t)lvl->size &&
+			img_lz4_decompress(dest, pixsz, buf, lvl->size) == pixsz) {
+		res = 0;
+	}
+	free(buf);
+	return res;
+}
+
+static size_t write_file(void *buf, size_t bytes, void *uptr)
+{
+	return fwrite(buf, 1, bytes, uptr);
+}
+
+int img_save_mipmap(struct img_pixmap *img, const char *fname, unsigned int flags)
+{
+	int res;
+	FILE *fp;
+	struct img_io io;
+
+	if(!(fp = fopen(fname, "wb"))) {
+		return -1;
+	}
+	img_io_init(&io);
+	img_io_set_user_data(&io, fp);
+	img_io_set_write_func(&io, write_file);
+	res = img_write_mipmap(img, &io, flags);
+	if(fclose(fp) == EOF) {
+		res = -1;
+	}
+	return res;
+}
+
+/* All levels are generated and compressed before anything is written, to
+ * build the level table at the start of the file.
+ */
+int img_write_mipmap(struct img_pixmap *img, struct img_io *io, unsigned int flags)
+{
+	int i, n, width, height, res = -1;
+	int first = img->fmt == IMG_FMT_RGBA32 ? 1 : 0;	/* first level we allocated */
+	long pos, pixsz, size;
+	unsigned char hdr[HDR_SIZE + MAX_LEVELS * LEVEL_SIZE], *ent;
+	void *data[MAX_LEVELS], *comp[MAX_LEVELS];
+	struct img_pixmap pix[MAX_LEVELS];
+	struct img_miplevel lvl[MAX_LEVELS];
+
+	n = 1;
+	width = img->width;
+	height = img->height;
+	while(width > 1 || height > 1) {
+		if(width > 1) width >>= 1;
+		if(height > 1) height >>= 1;
+		n++;
+	}
+	for(i=0; i<n; i++) {
+		img_init(pix + i);
+		comp[i] = 0;
+	}
+
+	if(first) {
+		pix[0] = *img;
+	} else if(img_copy(pix, img) == -1 || img_convert(pix, IMG_FMT_RGBA32) == -1) {
+		goto end;
+	}
+
+	pos = (HDR_SIZE + n * LEVEL_SIZE + LEVEL_ALIGN - 1) & ~(long)(LEVEL_ALIGN - 1);
+	for(i=0; i<n; i++) {
+		if(i > 0) {
+			width = pix[i - 1].width > 1 ? pix[i - 1].width >> 1 : 1;
+			height = pix[i - 1].height > 1 ? pix[i - 1].height >> 1 : 1;
+			if(img_resample(pix + i, pix + i - 1, width, height) == -1) {
+				goto end;
+			}
+		}
+		lvl[i].width = pix[i].width;
+		lvl[i].height = pix[i].height;
+		lvl[i].lz4 = 0;
+		pixsz = (long)pix[i].width * pix[i].height * 4;
+		data[i] = pix[i].pixels;
+		lvl[i].size = pixsz;
+
+		/* levels which don't get any smaller are stored uncompressed */
+		if((flags & IMG_MIPMAP_LZ4) && (comp[i] = malloc(IMG_LZ4_BOUND(pixsz)))) {
+			if((size = img_lz4_compress(comp[i], data[i], pixsz)) != -1 && size < pixsz) {
+				data[i] = comp[i];
+				lvl[i].size = size;
+				lvl[i].lz4 = 1;
+			}
+		}
+
+		lvl[i].offset = pos;
+		pos = (pos + lvl[i].size + LEVEL_ALIGN - 1) & ~(long)(LEVEL_ALIGN - 1);
+	}
+
+	memcpy(hdr, "IMIP", 4);
+	put32(hdr + 4, MIP_VERSION);
+	put32(hdr + 8, img->width);
+	put32(hdr + 12, img->height);
+	put32(hdr + 16, 0);
+	put32(hdr + 20, n);
+	for(i=0; i<n; i++) {
+		ent = hdr + HDR_SIZE + i * LEVEL_SIZE;
+		put32(ent, lvl[i].width);
+		put32(ent + 4, lvl[i].height);
+		put32(ent + 8, lvl[i].offset);
+		put32(ent + 12, lvl[i].size);
+		put32(ent + 16, lvl[i].lz4 ? COMP_LZ4 : COMP_NONE);
+	}
+	if(io->write(hdr, HDR_SIZE + n * LEVEL_SIZE, io->uptr) < (size_t)(HDR_SIZE + n * LEVEL_SIZE)) {
+		goto end;
+	}
+
+	pos = HDR_SIZE + n * LEVEL_SIZE;
+	for(i=0; i<n; i++) {
+		if(write_level(io, pos, lvl + i, data[i]) == -1) {
+			goto end;
+		}
+		pos = lvl[i].offset + lvl[i].size;
+	}
+	res = 0;
+
+end:
+	for(i=0; i<n; i++) {
+		if(i >= first) img_destroy(pix + i);
+		free(comp[i]);
+	}
+	return res;
+}
+
+/* pads the output from pos to the start of the level, and writes its data */
+static int write_level(struct img_io *io, long pos, struct img_miplevel *lvl, void *data)
+{
+	static const char zeros[LEVEL_ALIGN];
+	long pad = lvl->offset - pos;
+
+	if(pad > 0 && io->write((void*)zeros, pad, io->uptr) < (size_t)pad) {
+		return -1;
+	}
+	if(io->write(data, lvl->size, io->uptr) < (size_t)lvl->size) {
+		return -1;
+	}
+	return 0;
+}
+
+int img_load_mipmap(struct img_mipmap *mip, const char *fname)
+{
+	FILE *fp;
+	char magic[4];
+	struct img_io io;
+
+	memset(mip, 0, sizeof *mip);
+
+	if((mip->data = img_map_file(fname, &mip->size))) {
+		mip->mapped = 1;
+	} else {
+		/* can't be mapped, read it whole */
+		if(!(fp = fopen(fname, "rb"))) {
+			return -1;
+		}
+		if(fread(magic, 1, 4, fp) < 4 || memcmp(magic, "IMIP", 4) != 0 ||
+				fseek(fp, 0, SEEK_END) == -1 || (mip->size = ftell(fp)) <= 0 ||
+				!(mip->data = malloc(mip->size))) {
+			fclose(fp);
+			return -1;
+		}
+		rewind(fp);
+		if(fread((void*)mip->data, 1, mip->size, fp) < (size_t)mip->size) {
+			fclose(fp);
+			img_destroy_mipmap(mip);
+			return -1;
+		}
+		fclose(fp);
+	}
+
+	img_io_set_mem(&io, mip->data, mip->size);
+	if(!(mip->level = read_levels(&io, &mip->num_levels))) {
+		img_destroy_mipmap(mip);
+		return -1;
+	}
+	return 0;
+}
+
+void *img_mipmap_pixels(struct img_mipmap *mip, int level)
+{
+	long pixsz;
+	struct img_miplevel *lvl;
+
+	if(level < 0 || level >= mip->num_levels) {
+		return 0;
+	}
+	lvl = mip->level + level;
+
+	if(!lvl->pixels) {
+		if(!lvl->lz4) {
+			lvl->pixels = (void*)(mip->data + lvl->offset);
+		} else {
+			pixsz = (long)lvl->width * lvl->height * 4;
+			if(!(lvl->pixels = malloc(pixsz))) {
+				return 0;
+			}
+			if(img_lz4_decompress(lvl->pixels, pixsz, mip->data + lvl->offset, lvl->size) != pixsz) {
+				free(lvl->pixels);
+				lvl->pixels = 0;
+			}
+		}
+	}
+	return lvl->pixels;
+}
+
+void img_destroy_mipmap(struct img_mipmap *mip)
+{
+	int i;
+
+	for(i=0; i<mip->num_levels; i++) {
+		if(mip->level[i].lz4) {
+			free(mip->level[i].pixels);
+		}
+	}
+	free(mip->level);
+
+	if(mip->mapped) {
+		img_unmap_file((void*)mip->data, mip->size);
+	} else {
+		free((void*)mip->data);
+	}
+	memset(mip, 0, sizeof *mip);
+}
+
+static unsigned long get32(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+static void put32(unsigned char *p, unsigned long val)
+{
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = (val >> 24) & 0xff;
+}
@@ -24,47 +24,80 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <png.h>
 #include "imago2.h"
 #include "ftype_module.h"
+#include "threads.h"
+#include "stream.h"
 
-static int check_file(struct img_io *io);
 static int read_file(struct img_pixmap *img, struct img_io *io);
+static int read_ex(struct img_pixmap *img, struct img_io *io, const struct img_load_opt *opt);
+static int read_stream(struct img_io *io, const struct img_load_opt *opt, const struct img_stream *st);
+static int decode(struct img_pixmap *img, const struct img_stream *st, struct img_io *io,
+		const struct img_load_opt *opt);
+static int read_rows(png_struct *png, unsigned char **rows, int count);
+static void expand_16(unsigned char *row, int count);
 static int write_file(struct img_pixmap *img, struct img_io *io);
 
 static void read_func(png_struct *png, unsigned char *data, size_t len);
 static void write_func(png_struct *png, unsigned char *data, size_t len);
 static void flush_func(png_struct *png);
 
-static int png_type_to_fmt(int color_type, int channel_bits);
+static int is_float_fmt(int fmt);
+static int is_color_fmt(int fmt);
 static int fmt_to_png_type(enum img_fmt fmt);
 
 
 int img_register_png(void)
 {
-	static struct ftype_module mod = {".png", check_file, read_file, write_file};
+	static struct ftype_signature sig[] = {
+		{0, 8, "\x89PNG\r\n\x1a\n"},
+		{0}
+	};
+	static struct ftype_module mod = {".png", sig, 0, read_file, write_file, read_ex, read_stream};
 	return img_register_module(&mod);
 }
 
-static int check_file(struct img_io *io)
+static int read_file(struct img_pixmap *img, struct img_io *io)
 {
-	unsigned char sig[8];
-	int res;
-	long pos = io->seek(0, SEEK_CUR, io->uptr);
+	return read_ex(img, io, 0);
+}
 
-	if(io->read(sig, 8, io->uptr) < 8) {
-		io->seek(pos, SEEK_SET, io->uptr);
-		return -1;
+static int read_ex(struct img_pixmap *img, struct img_io *io, const struct img_load_opt *opt)
+{
+	if(opt && opt->preview) {
+		return -1;	/* no reduced resolution decoding */
 	}
+	return decode(img, 0, io, opt);
+}
 
-	res = png_sig_cmp(sig, 0, 8) == 0 ? 0 : -1;
-	io->seek(pos, SEEK_SET, io->uptr);
-	return res;
+static int read_stream(struct img_io *io, const struct img_load_opt *opt, const struct img_stream *st)
+{
+	if(opt && opt->preview) {
+		return -1;
+	}
+	return decode(0, st, io, opt);
 }
 
-static int read_file(struct img_pixmap *img, struct img_io *io)
+/* Decodes into img, or passes the rows to st if img is null. The libpng
+ * transforms expand palette, low bit depth and transparency-keyed images to 8
+ * bits per channel, and produce the requested RGBA32/BGRA32 layout directly.
+ * 16bit images are reduced to 8 bits if an 8bit format is requested, otherwise
+ * they're converted to floating point in place. Images decoded to a pixmap at
+ * their original size are decoded straight into it, everything else a band at
+ * a time through a row stream, so the whole decoded image is never kept twice.
+ */
+static int decode(struct img_pixmap *img, const struct img_stream *st, struct img_io *io,
+		const struct img_load_opt *opt)
 {
 	png_struct *png;
 	png_info *info;
-	int channel_bits, color_type, ilace_type, compression, filtering, fmt;
+	int channel_bits, color_type, ilace_type, compression, filtering;
+	int i, y, n, pass, num_passes, has_alpha, is_grey, width, height, res = -1;
+	int band_rows, want_fmt = opt ? opt->fmt : -1;
+	long pitch;
+	enum img_fmt fmt;
 	png_uint_32 xsz, ysz;
+	unsigned char *pixels, *band = 0, **rows = 0;
+	struct img_rowstream *rs = 0;
+	struct img_stream pixst;
 
 	if(!(png = png_create_read_struct(PNG_LIBPNG_VER_STRING, 0, 0, 0))) {
 		return -1;
@@ -82,49 +115,163 @@ static int read_file(struct img_pixmap *img, struct img_io *io)
 
 	png_set_read_fn(png, io, read_func);
 	png_set_sig_bytes(png, 0);
-	png_read_png(png, info, 0, 0);
+	png_read_info(png, info);
 
 	png_get_IHDR(png, info, &xsz, &ysz, &channel_bits, &color_type, &ilace_type,
 			&compression, &filtering);
-	if((fmt = png_type_to_fmt(color_type, channel_bits)) == -1) {
-		png_destroy_read_struct(&png, &info, 0);
-		return -1;
-	}
 
-	if(img_set_pixels(img, xsz, ysz, fmt, 0) == -1) {
-		png_destroy_read_struct(&png, &info, 0);
-		return -1;
+	has_alpha = (color_type & PNG_COLOR_MASK_ALPHA) || png_get_valid(png, info, PNG_INFO_tRNS);
+	is_grey = !(color_type & PNG_COLOR_MASK_COLOR);
+
+	png_set_expand(png);
+	if(channel_bits == 16) {
+		if(want_fmt >= 0 && !is_float_fmt(want_fmt)) {
+#ifdef PNG_READ_SCALE_16_TO_8_SUPPORTED
+			png_set_scale_16(png);
+#else
+			png_set_strip_16(png);
+#endif
+			channel_bits = 8;
+		}
+	} else {
+		channel_bits = 8;
 	}
+	/* there's no grey/alpha pixel format */
+	if(is_grey && (has_alpha || is_color_fmt(want_fmt))) {
+		png_set_gray_to_rgb(png);
+		is_grey = 0;
+	}
+	if(channel_bits == 8 && !is_grey && (want_fmt == IMG_FMT_RGBA32 || want_fmt == IMG_FMT_BGRA32)) {
+		if(!has_alpha) {
+			png_set_filler(png, 0xff, PNG_FILLER_AFTER);
+			has_alpha = 1;
+		}
+		if(want_fmt == IMG_FMT_BGRA32) {
+			png_set_bgr(png);
+		}
+	}
+	num_passes = png_set_interlace_handling(png);
+	png_read_update_info(png, info);
+
+	if(is_grey) {
+		fmt = channel_bits == 16 ? IMG_FMT_GREYF : IMG_FMT_GREY8;
+	} else if(has_alpha) {
+		if(channel_bits == 16) {
+			fmt = IMG_FMT_RGBAF;
+		} else {
+			fmt = want_fmt == IMG_FMT_BGRA32 ? IMG_FMT_BGRA32 : IMG_FMT_RGBA32;
+		}
+	} else {
+		fmt = channel_bits == 16 ? IMG_FMT_RGBF : IMG_FMT_RGB24;
+	}
+	/* 16bit samples are expanded in place, so each row is sized for the floats */
+	pitch = xsz * img_fmt_pixel_size(fmt);
+
+	width = xsz;
+	height = ysz;
+	if(opt && opt->target_size) {
+		opt->target_size(xsz, ysz, &width, &height, opt->cls);
+		if(width <= 0 || height <= 0) {
+			width = xsz;
+			height = ysz;
+		}
+	}
+
+	if(img && width >= (int)xsz && height >= (int)ysz) {
+		if(img_alloc_pixels(img, xsz, ysz, fmt) == -1) {
+			goto end;
+		}
+		pixels = img->pixels;
+		band_rows = ysz;
+	} else {
+		/* interlaced images need every row present for each pass */
+		band_rows = (IMG_MT_THRESHOLD + xsz - 1) / xsz;
+		if(num_passes > 1 || band_rows > (int)ysz) band_rows = ysz;
 
+		if(!st) {
+			img_stream_pixmap(&pixst, img);
+			st = &pixst;
+		}
+		if(!(rs = img_rowstream_begin(xsz, ysz, fmt, width, height, want_fmt, st))) {
+			goto end;
+		}
+		if(!(band = malloc(band_rows * pitch))) {
+			goto end;
+		}
+		pixels = band;
+	}
 
-	if(channel_bits == 8) {
-		unsigned int i;
-		unsigned char **lineptr = (unsigned char**)png_get_rows(png, info);
-		unsigned char *dest = img->pixels;
+	if(!(rows = malloc(band_rows * sizeof *rows))) {
+		goto end;
+	}
+	for(i=0; i<band_rows; i++) {
+		rows[i] = pixels + i * pitch;
+	}
 
-		for(i=0; i<ysz; i++) {
-			memcpy(dest, lineptr[i], xsz * img->pixelsz);
-			dest += xsz * img->pixelsz;
+	for(y=0; y<(int)ysz; y+=n) {
+		n = ysz - y < band_rows ? ysz - y : band_rows;
+		for(pass=0; pass<num_passes; pass++) {
+			if(read_rows(png, rows, n) == -1) {
+				goto end;
+			}
 		}
-	} else {
-		unsigned int i, j, num_elem;
-		unsigned char **lineptr = (unsigned char**)png_get_rows(png, info);
-		float *dest = img->pixels;
-
-		num_elem = img->pixelsz / sizeof(float);
-		for(i=0; i<ysz; i++) {
-			for(j=0; j<xsz * num_elem; j++) {
-				unsigned short val = (lineptr[i][j * 2] << 8) | lineptr[i][j * 2 + 1];
-				*dest++ = (float)val / 65535.0;
+		if(channel_bits == 16) {
+			for(i=0; i<n; i++) {
+				expand_16(rows[i], xsz * img_fmt_pixel_size(fmt) / sizeof(float));
 			}
 		}
+		if(rs && img_rowstream_push(rs, band, n) == -1) {
+			goto end;
+		}
 	}
 
+	if(rs) {
+		res = img_rowstream_end(rs);
+		rs = 0;
+	} else {
+		res = 0;
+		if(want_fmt >= 0) {
+			res = img_convert(img, want_fmt);
+		}
+	}
 
+end:
+	if(rs) {
+		img_rowstream_end(rs);
+	}
+	free(band);
+	free(rows);
 	png_destroy_read_struct(&png, &info, 0);
+	return res;
+}
+
+/* reads the next count rows, or the next pass over them for interlaced images */
+static int read_rows(png_struct *png, unsigned char **rows, int count)
+{
+	if(setjmp(png_jmpbuf(png))) {
+		return -1;
+	}
+	png_read_rows(png, rows, 0, count);
 	return 0;
 }
 
+/* converts count big endian 16bit samples at the start of row to floats.
+ * Works backwards, so that no sample is overwritten before it's read.
+ */
+static void expand_16(unsigned char *row, int count)
+{
+	int i;
+	unsigned short val;
+	unsigned char *src = row + (count - 1) * 2;
+	float *dest = (float*)row + count - 1;
+
+	for(i=0; i<count; i++) {
+		val = (src[0] << 8) | src[1];
+		*dest-- = (float)val / 65535.0;
+		src -= 2;
+	}
+}
+
 
 static int write_file(struct img_pixmap *img, struct img_io *io)
 {
@@ -202,7 +349,7 @@ static void read_func(png_struct *png, unsigned char *data, size_t len)
 {
 	struct img_io *io = (struct img_io*)png_get_io_ptr(png);
 
-	if(io->read(data, len, io->uptr) == -1) {
+	if(io->read(data, len, io->uptr) < len) {
 		longjmp(png_jmpbuf(png), 1);
 	}
 }
@@ -221,27 +368,14 @@ static void flush_func(png_struct *png)
 	/* XXX does it matter that we can't flush? */
 }
 
-static int png_type_to_fmt(int color_type, int channel_bits)
+static int is_float_fmt(int fmt)
 {
-	/* only 8 and 16 bits per channel ar supported at the moment */
-	if(channel_bits != 8 && channel_bits != 16) {
-		return -1;
-	}
-
-	switch(color_type) {
-	case PNG_COLOR_TYPE_RGB:
-		return channel_bits == 16 ? IMG_FMT_RGBF : IMG_FMT_RGB24;
-
-	case PNG_COLOR_TYPE_RGB_ALPHA:
-		return channel_bits == 16 ? IMG_FMT_RGBAF : IMG_FMT_RGBA32;
-
-	case PNG_COLOR_TYPE_GRAY:
-		return channel_bits == 16 ? IMG_FMT_GREYF : IMG_FMT_GREY8;
+	return fmt == IMG_FMT_GREYF || fmt == IMG_FMT_RGBF || fmt == IMG_FMT_RGBAF;
+}
 
-	default:
-		break;
-	}
-	return -1;
+static int is_color_fmt(int fmt)
+{
+	return fmt >= 0 && fmt != IMG_FMT_GREY8 && fmt != IMG_FMT_GREYF;
 }
 
 static int fmt_to_png_type(enum img_fmt fmt)
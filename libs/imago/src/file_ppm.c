@@ -25,35 +25,22 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "ftype_module.h"
 #include "byteord.h"
 
-static int check(struct img_io *io);
 static int read(struct img_pixmap *img, struct img_io *io);
 static int write(struct img_pixmap *img, struct img_io *io);
 
 int img_register_ppm(void)
 {
-	static struct ftype_module mod = {".ppm:.pgm:.pnm", check, read, write};
+	static struct ftype_signature sig[] = {
+		{0, 2, "P6"},
+		{0, 2, "P5"},
+		{0, 2, "P3"},
+		{0}
+	};
+	static struct ftype_module mod = {".ppm:.pgm:.pnm", sig, 0, read, write};
 	return img_register_module(&mod);
 }
 
 
-static int check(struct img_io *io)
-{
-	char id[2];
-	int res = -1;
-	long pos = io->seek(0, SEEK_CUR, io->uptr);
-
-	if(io->read(id, 2, io->uptr) < 2) {
-		io->seek(pos, SEEK_SET, io->uptr);
-		return -1;
-	}
-
-	if(id[0] == 'P' && (id[1] == '6' || id[1] == '3' || id[1] == '5')) {
-		res = 0;
-	}
-	io->seek(pos, SEEK_SET, io->uptr);
-	return res;
-}
-
 static int iofgetc(struct img_io *io)
 {
 	char c;
@@ -124,7 +111,7 @@ static int read(struct img_pixmap *img, struct img_io *io)
 		fmt = greyscale ? IMG_FMT_GREY8 : IMG_FMT_RGB24;
 	}
 
-	if(img_set_pixels(img, xsz, ysz, fmt, 0) == -1) {
+	if(img_alloc_pixels(img, xsz, ysz, fmt) == -1) {
 		return -1;
 	}
 
@@ -17,6 +17,8 @@
 #include <errno.h>
 #include "imago2.h"
 #include "ftype_module.h"
+#include "threads.h"
+#include "stream.h"
 
 
 typedef struct {
@@ -31,51 +33,52 @@ typedef struct {
 } rgbe_header_info;
 
 
-static int check(struct img_io *io);
+struct rgbe_decoder;
+
 static int read(struct img_pixmap *img, struct img_io *io);
+static int read_ex(struct img_pixmap *img, struct img_io *io, const struct img_load_opt *opt);
+static int read_stream(struct img_io *io, const struct img_load_opt *opt, const struct img_stream *st);
 static int write(struct img_pixmap *img, struct img_io *io);
 
 static int rgbe_read_header(struct img_io *io, int *width, int *height, rgbe_header_info * info);
 static int rgbe_write_header(struct img_io *io, int width, int height, rgbe_header_info * info);
-static int rgbe_read_pixels_rle(struct img_io *io, float *data, int scanline_width, int num_scanlines);
+static int decode(struct img_pixmap *img, const struct img_stream *st, struct img_io *io,
+		const struct img_load_opt *opt);
+static int read_scanline(struct rgbe_decoder *dec, unsigned char *dest);
+static void convert_rows(int start, int end, void *cls);
 static int rgbe_write_pixels_rle(struct img_io *io, float *data, int scanline_width, int num_scanlines);
 
 
 int img_register_rgbe(void)
 {
-	static struct ftype_module mod = {".rgbe:.pic:.hdr", check, read, write};
+	static struct ftype_signature sig[] = {
+		{0, 2, "#?"},
+		{0}
+	};
+	static struct ftype_module mod = {".rgbe:.pic:.hdr", sig, 0, read, write, read_ex, read_stream};
 	return img_register_module(&mod);
 }
 
 
-static int check(struct img_io *io)
+static int read(struct img_pixmap *img, struct img_io *io)
 {
-	int xsz, ysz, res;
-	long pos = io->seek(0, SEEK_CUR, io->uptr);
-
-	rgbe_header_info hdr;
-	res = rgbe_read_header(io, &xsz, &ysz, &hdr);
-
-	io->seek(pos, SEEK_SET, io->uptr);
-	return res;
+	return decode(img, 0, io, 0);
 }
 
-static int read(struct img_pixmap *img, struct img_io *io)
+static int read_ex(struct img_pixmap *img, struct img_io *io, const struct img_load_opt *opt)
 {
-	int xsz, ysz;
-	rgbe_header_info hdr;
-
-	if(rgbe_read_header(io, &xsz, &ysz, &hdr) == -1) {
+	if(opt && opt->preview) {
 		return -1;
 	}
+	return decode(img, 0, io, opt);
+}
 
-	if(img_set_pixels(img, xsz, ysz, IMG_FMT_RGBF, 0) == -1) {
-		return -1;
-	}
-	if(rgbe_read_pixels_rle(io, img->pixels, xsz, ysz) == -1) {
+static int read_stream(struct img_io *io, const struct img_load_opt *opt, const struct img_stream *st)
+{
+	if(opt && opt->preview) {
 		return -1;
 	}
-	return 0;
+	return decode(0, st, io, opt);
 }
 
 static int write(struct img_pixmap *img, struct img_io *io)
@@ -203,22 +206,6 @@ static INLINE void float2rgbe(unsigned char rgbe[4], float red, float green, flo
 	}
 }
 
-/* standard conversion from rgbe to float pixels */
-/* note: Ward uses ldexp(col+0.5,exp-(128+8)). However we wanted pixels */
-/*       in the range [0,1] to map back into the range [0,1]. */
-static INLINE void rgbe2float(float *red, float *green, float *blue, unsigned char rgbe[4])
-{
-	float f;
-
-	if(rgbe[3]) {				/*nonzero pixel */
-		f = ldexp(1.0, rgbe[3] - (int)(128 + 8));
-		*red = rgbe[0] * f;
-		*green = rgbe[1] * f;
-		*blue = rgbe[2] * f;
-	} else
-		*red = *green = *blue = 0.0;
-}
-
 /* default minimal header. modify if you want more information in header */
 static int rgbe_write_header(struct img_io *io, int width, int height, rgbe_header_info * info)
 {
@@ -335,20 +322,6 @@ static int rgbe_write_pixels(struct img_io *io, float *data, int numpixels)
 	return RGBE_RETURN_SUCCESS;
 }
 
-/* simple read routine.  will not correctly handle run length encoding */
-static int rgbe_read_pixels(struct img_io *io, float *data, int numpixels)
-{
-	unsigned char rgbe[4];
-
-	while(numpixels-- > 0) {
-		if(io->read(rgbe, sizeof(rgbe), io->uptr) < 1)
-			return rgbe_error(rgbe_read_error, NULL);
-		rgbe2float(&data[RGBE_DATA_RED], &data[RGBE_DATA_GREEN], &data[RGBE_DATA_BLUE], rgbe);
-		data += RGBE_DATA_SIZE;
-	}
-	return RGBE_RETURN_SUCCESS;
-}
-
 /* The code below is only needed for the run-length encoded files. */
 
 /* Run length encoding adds considerable complexity but does */
@@ -453,86 +426,278 @@ static int rgbe_write_pixels_rle(struct img_io *io, float *data, int scanline_wi
 	return RGBE_RETURN_SUCCESS;
 }
 
-static int rgbe_read_pixels_rle(struct img_io *io, float *data, int scanline_width, int num_scanlines)
+/* Reading is done a band of scanlines at a time. The scanlines are decoded
+ * sequentially into RGBE, with channels stored separately as in run length
+ * encoded files, and the band is then converted to the output format with the
+ * rows spread across threads. 8bit output is tone mapped directly, so the
+ * image is never held in floating point.
+ */
+#define INPUT_BUF_SIZE	4096
+#define GAMMA_LUT_SIZE	4096
+
+struct rgbe_decoder {
+	struct img_io *io;
+	/* input, read in place when the whole file is in memory */
+	const unsigned char *ptr, *end;
+	unsigned char buf[INPUT_BUF_SIZE];
+
+	int width, flat;
+	unsigned char *scanlines;	/* RGBE channels of each scanline in the band */
+	unsigned char *out;			/* converted pixels of the band */
+	enum img_fmt fmt;			/* RGBF, or tone mapped RGBA32/BGRA32 */
+	struct img_rgbe_conv conv;
+	float scale[256];			/* multiplier for each exponent */
+	unsigned char gamma[GAMMA_LUT_SIZE];
+};
+
+static int decode(struct img_pixmap *img, const struct img_stream *st, struct img_io *io,
+		const struct img_load_opt *opt)
 {
-	unsigned char rgbe[4], *scanline_buffer, *ptr, *ptr_end;
-	int i, count;
-	unsigned char buf[2];
+	struct rgbe_decoder *dec;
+	rgbe_header_info hdr;
+	struct img_rowstream *rs = 0;
+	struct img_stream pixst;
+	unsigned char *band = 0;
+	int i, y, n, band_rows, xsz, ysz, width, height, res = -1;
+	int want_fmt = opt ? opt->fmt : -1;
+	float exposure = opt && opt->exposure > 0.0f ? opt->exposure : 1.0f;
+	long pitch;
+
+	if(rgbe_read_header(io, &xsz, &ysz, &hdr) == -1 || xsz <= 0 || ysz <= 0) {
+		return -1;
+	}
+	if(!(dec = malloc(sizeof *dec))) {
+		return -1;
+	}
+	dec->io = io;
+	dec->width = xsz;
+	dec->scanlines = 0;
+	/* run length encoding is not allowed for these widths */
+	dec->flat = xsz < 8 || xsz > 0x7fff;
+	dec->ptr = dec->end = dec->buf;
+	if(io->data) {
+		long pos = io->seek(0, SEEK_CUR, io->uptr);
+		dec->ptr = io->data + pos;
+		dec->end = io->data + io->size;
+		io->seek(0, SEEK_END, io->uptr);
+	}
 
-	if((scanline_width < 8) || (scanline_width > 0x7fff))
-		/* run length encoding is not allowed so read flat */
-		return rgbe_read_pixels(io, data, scanline_width * num_scanlines);
-	scanline_buffer = NULL;
-	/* read in each successive scanline */
-	while(num_scanlines > 0) {
-		if(io->read(rgbe, sizeof(rgbe), io->uptr) < 1) {
-			free(scanline_buffer);
-			return rgbe_error(rgbe_read_error, NULL);
+	dec->fmt = IMG_FMT_RGBF;
+	if(want_fmt >= 0 && want_fmt != IMG_FMT_GREYF && want_fmt != IMG_FMT_RGBF && want_fmt != IMG_FMT_RGBAF) {
+		dec->fmt = want_fmt == IMG_FMT_BGRA32 ? IMG_FMT_BGRA32 : IMG_FMT_RGBA32;
+	} else {
+		exposure = 1.0f;
+	}
+	dec->scale[0] = 0.0f;
+	for(i=1; i<256; i++) {
+		dec->scale[i] = (float)ldexp(1.0, i - (int)(128 + 8)) * exposure;
+	}
+	for(i=0; i<GAMMA_LUT_SIZE; i++) {
+		dec->gamma[i] = (unsigned char)(pow(i / (double)(GAMMA_LUT_SIZE - 1), 1.0 / 2.2) * 255.0 + 0.5);
+	}
+	dec->conv.scale = dec->scale;
+	dec->conv.tonemap = opt ? opt->tonemap : IMG_TONEMAP_CLAMP;
+	dec->conv.gamma = dec->gamma;
+	dec->conv.gamma_size = GAMMA_LUT_SIZE;
+	dec->conv.bgra = dec->fmt == IMG_FMT_BGRA32;
+	pitch = xsz * img_fmt_pixel_size(dec->fmt);
+
+	width = xsz;
+	height = ysz;
+	if(opt && opt->target_size) {
+		opt->target_size(xsz, ysz, &width, &height, opt->cls);
+		if(width <= 0 || height <= 0) {
+			width = xsz;
+			height = ysz;
 		}
-		if((rgbe[0] != 2) || (rgbe[1] != 2) || (rgbe[2] & 0x80)) {
-			/* this file is not run length encoded */
-			rgbe2float(&data[0], &data[1], &data[2], rgbe);
-			data += RGBE_DATA_SIZE;
-			free(scanline_buffer);
-			return rgbe_read_pixels(io, data, scanline_width * num_scanlines - 1);
+	}
+
+	band_rows = (IMG_MT_THRESHOLD + xsz - 1) / xsz;
+	if(band_rows > ysz) band_rows = ysz;
+
+	if(img && width >= xsz && height >= ysz) {
+		if(img_alloc_pixels(img, xsz, ysz, dec->fmt) == -1) {
+			goto end;
+		}
+	} else {
+		if(!st) {
+			img_stream_pixmap(&pixst, img);
+			st = &pixst;
 		}
-		if((((int)rgbe[2]) << 8 | rgbe[3]) != scanline_width) {
-			free(scanline_buffer);
-			return rgbe_error(rgbe_format_error, "wrong scanline width");
+		if(!(rs = img_rowstream_begin(xsz, ysz, dec->fmt, width, height, want_fmt, st))) {
+			goto end;
 		}
-		if(scanline_buffer == NULL)
-			scanline_buffer = (unsigned char *)
-				malloc(sizeof(unsigned char) * 4 * scanline_width);
-		if(scanline_buffer == NULL)
-			return rgbe_error(rgbe_memory_error, "unable to allocate buffer space");
-
-		ptr = &scanline_buffer[0];
-		/* read each of the four channels for the scanline into the buffer */
-		for(i = 0; i < 4; i++) {
-			ptr_end = &scanline_buffer[(i + 1) * scanline_width];
-			while(ptr < ptr_end) {
-				if(io->read(buf, sizeof(buf[0]) * 2, io->uptr) < 1) {
-					free(scanline_buffer);
-					return rgbe_error(rgbe_read_error, NULL);
+		if(!(band = malloc(band_rows * pitch))) {
+			goto end;
+		}
+	}
+	if(!(dec->scanlines = malloc(band_rows * xsz * 4))) {
+		goto end;
+	}
+
+	for(y=0; y<ysz; y+=n) {
+		n = ysz - y < band_rows ? ysz - y : band_rows;
+		for(i=0; i<n; i++) {
+			if(read_scanline(dec, dec->scanlines + i * xsz * 4) == -1) {
+				goto end;
+			}
+		}
+		dec->out = rs ? band : (unsigned char*)img->pixels + y * pitch;
+		img_parallel_rows(n, xsz, convert_rows, dec);
+
+		if(rs && img_rowstream_push(rs, band, n) == -1) {
+			goto end;
+		}
+	}
+
+	if(rs) {
+		res = img_rowstream_end(rs);
+		rs = 0;
+	} else {
+		res = 0;
+		if(want_fmt >= 0) {
+			res = img_convert(img, want_fmt);
+		}
+	}
+
+end:
+	if(rs) {
+		img_rowstream_end(rs);
+	}
+	free(band);
+	free(dec->scanlines);
+	free(dec);
+	return res;
+}
+
+static int fill_input(struct rgbe_decoder *dec)
+{
+	size_t sz;
+
+	if(dec->io->data) {
+		return -1;	/* in place, nothing left */
+	}
+	sz = dec->io->read(dec->buf, INPUT_BUF_SIZE, dec->io->uptr);
+	if(sz == 0 || sz == (size_t)-1) {
+		return -1;
+	}
+	dec->ptr = dec->buf;
+	dec->end = dec->buf + sz;
+	return 0;
+}
+
+static INLINE int next_byte(struct rgbe_decoder *dec)
+{
+	if(dec->ptr >= dec->end && fill_input(dec) == -1) {
+		return -1;
+	}
+	return *dec->ptr++;
+}
+
+static int read_bytes(struct rgbe_decoder *dec, unsigned char *dest, int count)
+{
+	int sz;
+
+	while(count > 0) {
+		if(dec->ptr >= dec->end && fill_input(dec) == -1) {
+			return -1;
+		}
+		sz = dec->end - dec->ptr;
+		if(sz > count) sz = count;
+		memcpy(dest, dec->ptr, sz);
+		dec->ptr += sz;
+		dest += sz;
+		count -= sz;
+	}
+	return 0;
+}
+
+/* reads pixels [start, width) of a scanline which isn't run length encoded */
+static int read_flat(struct rgbe_decoder *dec, unsigned char *dest, int start)
+{
+	int i, j;
+	unsigned char rgbe[4];
+
+	for(i=start; i<dec->width; i++) {
+		if(read_bytes(dec, rgbe, 4) == -1) {
+			return rgbe_error(rgbe_format_error, "unexpected end of file");
+		}
+		for(j=0; j<4; j++) {
+			dest[i + j * dec->width] = rgbe[j];
+		}
+	}
+	return 0;
+}
+
+/* reads a scanline, storing each of the four channels (r,g,b,e) separately */
+static int read_scanline(struct rgbe_decoder *dec, unsigned char *dest)
+{
+	int i, code, val, count, width = dec->width;
+	unsigned char rgbe[4], *ptr, *end;
+
+	if(dec->flat) {
+		return read_flat(dec, dest, 0);
+	}
+
+	if(read_bytes(dec, rgbe, 4) == -1) {
+		return rgbe_error(rgbe_format_error, "unexpected end of file");
+	}
+	if((rgbe[0] != 2) || (rgbe[1] != 2) || (rgbe[2] & 0x80)) {
+		/* this file is not run length encoded, rgbe is the first pixel */
+		dec->flat = 1;
+		for(i=0; i<4; i++) {
+			dest[i * width] = rgbe[i];
+		}
+		return read_flat(dec, dest, 1);
+	}
+	if((((int)rgbe[2]) << 8 | rgbe[3]) != width) {
+		return rgbe_error(rgbe_format_error, "wrong scanline width");
+	}
+
+	for(i=0; i<4; i++) {
+		ptr = dest + i * width;
+		end = ptr + width;
+		while(ptr < end) {
+			if((code = next_byte(dec)) == -1) {
+				return rgbe_error(rgbe_format_error, "unexpected end of file");
+			}
+			if(code > 128) {
+				/* a run of the same value */
+				count = code - 128;
+				if(count > end - ptr || (val = next_byte(dec)) == -1) {
+					return rgbe_error(rgbe_format_error, "bad scanline data");
 				}
-				if(buf[0] > 128) {
-					/* a run of the same value */
-					count = buf[0] - 128;
-					if((count == 0) || (count > ptr_end - ptr)) {
-						free(scanline_buffer);
-						return rgbe_error(rgbe_format_error, "bad scanline data");
-					}
-					while(count-- > 0)
-						*ptr++ = buf[1];
-				} else {
-					/* a non-run */
-					count = buf[0];
-					if((count == 0) || (count > ptr_end - ptr)) {
-						free(scanline_buffer);
-						return rgbe_error(rgbe_format_error, "bad scanline data");
-					}
-					*ptr++ = buf[1];
-					if(--count > 0) {
-						if(io->read(ptr, sizeof(*ptr) * count, io->uptr) < 1) {
-							free(scanline_buffer);
-							return rgbe_error(rgbe_read_error, NULL);
-						}
-						ptr += count;
-					}
+				memset(ptr, val, count);
+			} else {
+				/* a non-run */
+				count = code;
+				if(count == 0 || count > end - ptr || read_bytes(dec, ptr, count) == -1) {
+					return rgbe_error(rgbe_format_error, "bad scanline data");
 				}
 			}
+			ptr += count;
 		}
-		/* now convert data from buffer into floats */
-		for(i = 0; i < scanline_width; i++) {
-			rgbe[0] = scanline_buffer[i];
-			rgbe[1] = scanline_buffer[i + scanline_width];
-			rgbe[2] = scanline_buffer[i + 2 * scanline_width];
-			rgbe[3] = scanline_buffer[i + 3 * scanline_width];
-			rgbe2float(&data[RGBE_DATA_RED], &data[RGBE_DATA_GREEN], &data[RGBE_DATA_BLUE], rgbe);
-			data += RGBE_DATA_SIZE;
+	}
+	return 0;
+}
+
+/* converts rows [start, end) of the band to the output format */
+static void convert_rows(int start, int end, void *cls)
+{
+	int i, width;
+	struct rgbe_decoder *dec = cls;
+	int pixsz = img_fmt_pixel_size(dec->fmt);
+
+	width = dec->width;
+
+	for(i=start; i<end; i++) {
+		unsigned char *src = dec->scanlines + i * width * 4;
+		unsigned char *dest = dec->out + i * width * pixsz;
+
+		if(dec->fmt == IMG_FMT_RGBF) {
+			img_rgbe_to_float((float*)dest, src, width, width, dec->scale);
+		} else {
+			img_rgbe_to_rgba(dest, src, width, width, &dec->conv);
 		}
-		num_scanlines--;
 	}
-	free(scanline_buffer);
-	return RGBE_RETURN_SUCCESS;
 }
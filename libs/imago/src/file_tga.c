@@ -71,11 +71,12 @@ struct tga_footer {
 static int check(struct img_io *io);
 static int read_tga(struct img_pixmap *img, struct img_io *io);
 static int write_tga(struct img_pixmap *img, struct img_io *io);
+static int read_raw_row(struct img_io *io, int width, int pixel_bytes, unsigned char *dest);
 static int read_pixel(struct img_io *io, int rdalpha, unsigned char *pix);
 
 int img_register_tga(void)
 {
-	static struct ftype_module mod = {".tga:.targa", check, read_tga, write_tga};
+	static struct ftype_module mod = {".tga:.targa", 0, check, read_tga, write_tga};
 	return img_register_module(&mod);
 }
 
@@ -148,7 +149,7 @@ static int read_tga(struct img_pixmap *img, struct img_io *io)
 	rdalpha = hdr.img_desc & 0xf;
 	pixel_bytes = rdalpha ? 4 : 3;
 
-	if(img_set_pixels(img, x, y, rdalpha ? IMG_FMT_RGBA32 : IMG_FMT_RGB24, 0) == -1) {
+	if(img_alloc_pixels(img, x, y, rdalpha ? IMG_FMT_RGBA32 : IMG_FMT_RGB24) == -1) {
 		return -1;
 	}
 
@@ -158,6 +159,13 @@ static int read_tga(struct img_pixmap *img, struct img_io *io)
 
 		ptr = (unsigned char*)img->pixels + ((hdr.img_desc & 0x20) ? i : y - (i + 1)) * x * pixel_bytes;
 
+		if(!IS_RLE(hdr.img_type)) {
+			if(read_raw_row(io, x, pixel_bytes, ptr) == -1) {
+				return -1;
+			}
+			continue;
+		}
+
 		for(j=0; j<x; j++) {
 			/* if the image is raw, then just read the next pixel */
 			if(!IS_RLE(hdr.img_type)) {
@@ -204,6 +212,43 @@ static int write_tga(struct img_pixmap *img, struct img_io *io)
 	return -1;	/* TODO */
 }
 
+/* reads a row of uncompressed pixels at once, straight from memory if the
+ * input is in memory, and swaps them from BGR(A) to RGB(A)
+ */
+static int read_raw_row(struct img_io *io, int width, int pixel_bytes, unsigned char *dest)
+{
+	int i;
+	unsigned char tmp;
+	long pos, rowsz = (long)width * pixel_bytes;
+	const unsigned char *src = dest;
+
+	if(io->data) {
+		pos = io->seek(0, SEEK_CUR, io->uptr);
+		if(io->size - pos < rowsz) {
+			return -1;
+		}
+		src = io->data + pos;
+		io->seek(rowsz, SEEK_CUR, io->uptr);
+	} else {
+		if(io->read(dest, rowsz, io->uptr) < (size_t)rowsz) {
+			return -1;
+		}
+	}
+
+	for(i=0; i<width; i++) {
+		tmp = src[0];
+		dest[0] = src[2];
+		dest[1] = src[1];
+		dest[2] = tmp;
+		if(pixel_bytes > 3) {
+			dest[3] = src[3];
+		}
+		src += pixel_bytes;
+		dest += pixel_bytes;
+	}
+	return 0;
+}
+
 static int read_pixel(struct img_io *io, int rdalpha, unsigned char *pix)
 {
 	int r, g, b, a;
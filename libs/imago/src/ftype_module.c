@@ -44,18 +44,50 @@ int img_register_module(struct ftype_module *mod)
 	return 0;
 }
 
+/* The start of the file is read once, and matched against the signatures of
+ * all modules, leaving the stream where it was. Images in memory are matched
+ * in place. Only if no signature matches, the modules which can't be identified
+ * by one get to check the file themselves.
+ */
 struct ftype_module *img_find_format_module(struct img_io *io)
 {
 	struct list_node *node;
+	struct ftype_signature *sig;
+	unsigned char buf[FTYPE_HDR_SIZE];
+	const unsigned char *hdr = buf;
+	long size, pos;
 
 	if(!done_init) {
 		img_modules_init();
 		done_init = 1;
 	}
 
+	pos = io->seek(0, SEEK_CUR, io->uptr);
+	if(io->data) {
+		hdr = io->data + pos;
+		size = io->size - pos;
+	} else {
+		size = io->read(buf, sizeof buf, io->uptr);
+		io->seek(pos, SEEK_SET, io->uptr);
+	}
+
+	node = modules;
+	while(node) {
+		if((sig = node->module->sig)) {
+			while(sig->magic) {
+				if(sig->offset + sig->size <= size &&
+						memcmp(hdr + sig->offset, sig->magic, sig->size) == 0) {
+					return node->module;
+				}
+				sig++;
+			}
+		}
+		node = node->next;
+	}
+
 	node = modules;
 	while(node) {
-		if(node->module->check(io) != -1) {
+		if(node->module->check && node->module->check(io) != -1) {
 			return node->module;
 		}
 		node = node->next;
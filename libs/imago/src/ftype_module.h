@@ -21,12 +21,28 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "imago2.h"
 
+/* size of the file header read for matching signatures */
+#define FTYPE_HDR_SIZE	64
+
+/* a magic number at a fixed offset in the file header */
+struct ftype_signature {
+	int offset, size;
+	const char *magic;
+};
+
 struct ftype_module {
 	char *suffix;	/* used for format autodetection during saving only */
 
+	/* signatures identifying the format, terminated by a null magic */
+	struct ftype_signature *sig;
+	/* only for formats which can't be identified by a signature */
 	int (*check)(struct img_io *io);
 	int (*read)(struct img_pixmap *img, struct img_io *io);
 	int (*write)(struct img_pixmap *img, struct img_io *io);
+	/* optional: read honoring the load options, including target_size */
+	int (*read_ex)(struct img_pixmap *img, struct img_io *io, const struct img_load_opt *opt);
+	/* optional: decode incrementally, passing rows to an img_stream */
+	int (*read_stream)(struct img_io *io, const struct img_load_opt *opt, const struct img_stream *st);
 };
 
 int img_register_module(struct ftype_module *mod);
@@ -35,5 +51,11 @@ struct ftype_module *img_find_format_module(struct img_io *io);
 struct ftype_module *img_guess_format(const char *fname);
 struct ftype_module *img_get_module(int idx);
 
+/* maps a regular file read-only (imago2.c), returns null if it can't, or if
+ * mapping is disabled or not supported (see img_set_mmap)
+ */
+void *img_map_file(const char *fname, long *size);
+void img_unmap_file(void *data, long size);
+
 
 #endif	/* FTYPE_MODULE_H_ */
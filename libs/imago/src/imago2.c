@@ -22,10 +22,25 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "imago2.h"
 #include "ftype_module.h"
 
-static int pixel_size(enum img_fmt fmt);
+#if defined(unix) || defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define HAVE_MMAP
+#endif
+
+/* image files are mapped instead of read, see img_set_mmap */
+static int use_mmap;
+
 static size_t def_read(void *buf, size_t bytes, void *uptr);
 static size_t def_write(void *buf, size_t bytes, void *uptr);
 static long def_seek(long offset, int whence, void *uptr);
+static size_t mem_read(void *buf, size_t bytes, void *uptr);
+static void init_file_io(struct img_io *io, FILE *fp);
+static long mem_seek(long offset, int whence, void *uptr);
+static int load_file(const char *fname, struct img_pixmap *img, const struct img_load_opt *opt,
+		const struct img_stream *st);
 
 
 void img_init(struct img_pixmap *img)
@@ -33,7 +48,7 @@ void img_init(struct img_pixmap *img)
 	img->pixels = 0;
 	img->width = img->height = 0;
 	img->fmt = IMG_FMT_RGBA32;
-	img->pixelsz = pixel_size(img->fmt);
+	img->pixelsz = img_fmt_pixel_size(img->fmt);
 	img->name = 0;
 }
 
@@ -92,7 +107,7 @@ int img_copy(struct img_pixmap *dest, struct img_pixmap *src)
 int img_set_pixels(struct img_pixmap *img, int w, int h, enum img_fmt fmt, void *pix)
 {
 	void *newpix;
-	int pixsz = pixel_size(fmt);
+	int pixsz = img_fmt_pixel_size(fmt);
 
 	if(!(newpix = malloc(w * h * pixsz))) {
 		return -1;
@@ -113,6 +128,40 @@ int img_set_pixels(struct img_pixmap *img, int w, int h, enum img_fmt fmt, void
 	return 0;
 }
 
+int img_alloc_pixels(struct img_pixmap *img, int w, int h, enum img_fmt fmt)
+{
+	void *newpix;
+	int pixsz = img_fmt_pixel_size(fmt);
+
+	if(!img->pixels || img->width * img->height * img->pixelsz != w * h * pixsz) {
+		if(!(newpix = malloc(w * h * pixsz))) {
+			return -1;
+		}
+		free(img->pixels);
+		img->pixels = newpix;
+	}
+	img->width = w;
+	img->height = h;
+	img->pixelsz = pixsz;
+	img->fmt = fmt;
+	return 0;
+}
+
+void img_move(struct img_pixmap *dest, struct img_pixmap *src)
+{
+	if(dest == src) return;
+
+	free(dest->pixels);
+	dest->pixels = src->pixels;
+	dest->width = src->width;
+	dest->height = src->height;
+	dest->pixelsz = src->pixelsz;
+	dest->fmt = src->fmt;
+
+	src->pixels = 0;
+	src->width = src->height = 0;
+}
+
 void *img_load_pixels(const char *fname, int *xsz, int *ysz, enum img_fmt fmt)
 {
 	struct img_pixmap img;
@@ -157,14 +206,52 @@ void img_free_pixels(void *pix)
 }
 
 int img_load(struct img_pixmap *img, const char *fname)
+{
+	return img_load_ex(img, fname, 0);
+}
+
+void img_load_opt_init(struct img_load_opt *opt)
+{
+	memset(opt, 0, sizeof *opt);
+	opt->fmt = -1;
+	opt->exposure = 1.0f;
+}
+
+int img_load_ex(struct img_pixmap *img, const char *fname, const struct img_load_opt *opt)
+{
+	return load_file(fname, img, opt, 0);
+}
+
+int img_load_stream(const char *fname, const struct img_load_opt *opt, const struct img_stream *st)
+{
+	return load_file(fname, 0, opt, st);
+}
+
+/* reads fname with img_read_ex, or with img_read_stream if img is null. Files
+ * are mapped in memory when possible.
+ */
+static int load_file(const char *fname, struct img_pixmap *img, const struct img_load_opt *opt,
+		const struct img_stream *st)
 {
 	int res;
 	FILE *fp;
+	struct img_io io;
+	void *data;
+	long size;
+
+	if((data = img_map_file(fname, &size))) {
+		img_io_set_mem(&io, data, size);
+		res = img ? img_read_ex(img, &io, opt) : img_read_stream(&io, opt, st);
+		img_unmap_file(data, size);
+		return res;
+	}
 
+	/* not a regular file, it can't be mapped, or mapping is disabled */
 	if(!(fp = fopen(fname, "rb"))) {
 		return -1;
 	}
-	res = img_read_file(img, fp);
+	init_file_io(&io, fp);
+	res = img ? img_read_ex(img, &io, opt) : img_read_stream(&io, opt, st);
 	fclose(fp);
 	return res;
 }
@@ -187,17 +274,17 @@ int img_save(struct img_pixmap *img, const char *fname)
 
 int img_read_file(struct img_pixmap *img, FILE *fp)
 {
-	struct img_io io = {0, def_read, def_write, def_seek};
+	struct img_io io;
 
-	io.uptr = fp;
+	init_file_io(&io, fp);
 	return img_read(img, &io);
 }
 
 int img_write_file(struct img_pixmap *img, FILE *fp)
 {
-	struct img_io io = {0, def_read, def_write, def_seek};
+	struct img_io io;
 
-	io.uptr = fp;
+	init_file_io(&io, fp);
 	return img_write(img, &io);
 }
 
@@ -211,6 +298,64 @@ int img_read(struct img_pixmap *img, struct img_io *io)
 	return -1;
 }
 
+int img_read_ex(struct img_pixmap *img, struct img_io *io, const struct img_load_opt *opt)
+{
+	int width, height;
+	struct ftype_module *mod;
+
+	if(!(mod = img_find_format_module(io))) {
+		return -1;
+	}
+	if(mod->read_ex) {
+		return mod->read_ex(img, io, opt);
+	}
+	if(opt && opt->preview) {
+		return -1;
+	}
+
+	if(mod->read(img, io) == -1) {
+		return -1;
+	}
+	if(opt && opt->target_size) {
+		width = img->width;
+		height = img->height;
+		opt->target_size(img->width, img->height, &width, &height, opt->cls);
+		if(width > 0 && height > 0 && (width < img->width || height < img->height)) {
+			if(img_resize(img, width, height) == -1) {
+				return -1;
+			}
+		}
+	}
+	if(opt && opt->fmt >= 0) {
+		return img_convert(img, opt->fmt);
+	}
+	return 0;
+}
+
+int img_read_stream(struct img_io *io, const struct img_load_opt *opt, const struct img_stream *st)
+{
+	int res = 0;
+	struct ftype_module *mod;
+	struct img_pixmap img;
+
+	if(!(mod = img_find_format_module(io))) {
+		return -1;
+	}
+	if(mod->read_stream) {
+		return mod->read_stream(io, opt, st);
+	}
+
+	/* no incremental decoder for this format, stream from the decoded image */
+	img_init(&img);
+	if(img_read_ex(&img, io, opt) == -1 ||
+			st->begin(img.width, img.height, img.fmt, st->cls) == -1 ||
+			st->rows(img.pixels, 0, img.height, st->cls) == -1) {
+		res = -1;
+	}
+	img_destroy(&img);
+	return res;
+}
+
 int img_write(struct img_pixmap *img, struct img_io *io)
 {
 	struct ftype_module *mod;
@@ -395,14 +540,24 @@ void img_getpixel4f(struct img_pixmap *img, int x, int y, float *r, float *g, fl
 	}
 }
 
+void img_io_init(struct img_io *io)
+{
+	memset(io, 0, sizeof *io);
+}
+
+/* Replacing the source or the read/seek functions invalidates any view of the
+ * input in memory from img_io_set_mem.
+ */
 void img_io_set_user_data(struct img_io *io, void *uptr)
 {
 	io->uptr = uptr;
+	io->data = 0;
 }
 
 void img_io_set_read_func(struct img_io *io, size_t (*read)(void*, size_t, void*))
 {
 	io->read = read;
+	io->data = 0;
 }
 
 void img_io_set_write_func(struct img_io *io, size_t (*write)(void*, size_t, void*))
@@ -413,10 +568,21 @@ void img_io_set_write_func(struct img_io *io, size_t (*write)(void*, size_t, voi
 void img_io_set_seek_func(struct img_io *io, long (*seek)(long, int, void*))
 {
 	io->seek = seek;
+	io->data = 0;
 }
 
+void img_io_set_mem(struct img_io *io, const void *data, long size)
+{
+	img_io_init(io);
+	io->uptr = io;
+	io->read = mem_read;
+	io->seek = mem_seek;
+	io->data = data;
+	io->size = size;
+}
 
-static int pixel_size(enum img_fmt fmt)
+
+int img_fmt_pixel_size(enum img_fmt fmt)
 {
 	switch(fmt) {
 	case IMG_FMT_GREY8:
@@ -458,3 +624,84 @@ static long def_seek(long offset, int whence, void *uptr)
 	return ftell(uptr);
 }
 
+static void init_file_io(struct img_io *io, FILE *fp)
+{
+	img_io_init(io);
+	io->uptr = fp;
+	io->read = def_read;
+	io->write = def_write;
+	io->seek = def_seek;
+}
+
+static size_t mem_read(void *buf, size_t bytes, void *uptr)
+{
+	struct img_io *io = uptr;
+	long left = io->size - io->pos;
+
+	if(left <= 0) return 0;
+	if((long)bytes > left) bytes = left;
+	memcpy(buf, io->data + io->pos, bytes);
+	io->pos += bytes;
+	return bytes;
+}
+
+static long mem_seek(long offset, int whence, void *uptr)
+{
+	struct img_io *io = uptr;
+
+	switch(whence) {
+	case SEEK_SET:
+		io->pos = offset;
+		break;
+	case SEEK_CUR:
+		io->pos += offset;
+		break;
+	case SEEK_END:
+		io->pos = io->size + offset;
+		break;
+	default:
+		return -1;
+	}
+	if(io->pos < 0) io->pos = 0;
+	if(io->pos > io->size) io->pos = io->size;
+	return io->pos;
+}
+
+void img_set_mmap(int enable)
+{
+	use_mmap = enable;
+}
+
+void *img_map_file(const char *fname, long *size)
+{
+#ifdef HAVE_MMAP
+	int fd;
+	struct stat st;
+	void *data;
+
+	if(!use_mmap || (fd = open(fname, O_RDONLY)) == -1) {
+		return 0;
+	}
+	if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size <= 0) {
+		close(fd);
+		return 0;
+	}
+	data = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(data == MAP_FAILED) {
+		return 0;
+	}
+	madvise(data, st.st_size, MADV_SEQUENTIAL);
+	*size = st.st_size;
+	return data;
+#else
+	return 0;
+#endif
+}
+
+void img_unmap_file(void *data, long size)
+{
+#ifdef HAVE_MMAP
+	munmap(data, size);
+#endif
+}
@@ -55,6 +55,55 @@ struct img_io {
 	size_t (*read)(void *buf, size_t bytes, void *uptr);
 	size_t (*write)(void *buf, size_t bytes, void *uptr);
 	long (*seek)(long offs, int whence, void *uptr);
+
+	/* Optional view of the whole input in memory, set by img_io_set_mem.
+	 * Decoders which can use it access the data in place, instead of copying
+	 * it through read. The current position is still given by seek. Must be
+	 * null otherwise, see img_io_init.
+	 */
+	const unsigned char *data;
+	long size;
+	long pos;	/* used by the img_io_set_mem read/seek functions */
+};
+
+/* tone mapping operators for high dynamic range images */
+enum {
+	IMG_TONEMAP_CLAMP,		/* clamp to [0, 1], same as img_convert */
+	IMG_TONEMAP_REINHARD,	/* x / (1 + x) */
+	IMG_TONEMAP_ACES		/* filmic curve (Narkowicz's fit of ACES) */
+};
+
+/* optional parameters for img_load_ex / img_read_ex. Initialize with
+ * img_load_opt_init before setting any fields.
+ */
+struct img_load_opt {
+	/* Called once the size of the image is known, before decoding it. Setting
+	 * *res_width and *res_height to a smaller size downscales the image while
+	 * loading. Formats which support it (JPEG) decode at a reduced resolution
+	 * directly, and everything is finished with the area filter of img_resize.
+	 */
+	void (*target_size)(int width, int height, int *res_width, int *res_height, void *cls);
+	void *cls;
+
+	/* pixel format to return the image in, or -1 (the default) for the format
+	 * closest to that of the file. Formats which support it (JPEG, PNG) decode into
+	 * RGBA32 or BGRA32 directly, everything else is converted with img_convert.
+	 */
+	int fmt;
+
+	/* Quick, lower quality decoding, for showing a preview while the image is
+	 * loaded properly. Formats which can't decode at a reduced resolution
+	 * directly (everything except JPEG) fail without decoding anything.
+	 */
+	int preview;
+
+	/* Mapping of high dynamic range images to 8bit pixel formats, and the
+	 * exposure they're scaled by first (default 1). Formats which support it
+	 * (RGBE) tone map straight into the requested 8bit format, Reinhard and
+	 * ACES followed by gamma 2.2 encoding. Float formats are left linear.
+	 */
+	int tonemap;
+	float exposure;
 };
 
 #ifdef __cplusplus
@@ -93,6 +142,18 @@ int img_copy(struct img_pixmap *dest, struct img_pixmap *src);
  */
 int img_set_pixels(struct img_pixmap *img, int w, int h, IMG_OPTARG(enum img_fmt fmt, IMG_FMT_RGBA32), IMG_OPTARG(void *pix, 0));
 
+/* allocates a pixel buffer of the specified dimensions and format, without
+ * initializing it, for callers which are about to overwrite every pixel.
+ * If the pixmap already has a buffer of the same size, it's reused as is, which
+ * lets callers provide the buffer an image is decoded into.
+ */
+int img_alloc_pixels(struct img_pixmap *img, int w, int h, enum img_fmt fmt);
+
+/* transfers the pixel buffer of src to dest, along with its dimensions and
+ * format, freeing any pixels dest had before. src is left without pixels.
+ */
+void img_move(struct img_pixmap *dest, struct img_pixmap *src);
+
 /* Simplified image loading
  * Loads the specified file, and returns a pointer to an array of pixels of the
  * requested pixel format. The width and height of the image are returned through
@@ -120,6 +181,36 @@ int img_load(struct img_pixmap *img, const char *fname);
 /* Saves the supplied pixmap to a file. The output filetype is guessed by the filename suffix */
 int img_save(struct img_pixmap *img, const char *fname);
 
+/* Row-streaming decoding, for loading images without holding them in memory
+ * whole. The decoded image is passed to the callbacks a band of rows at a time,
+ * from top to bottom, after applying the load options as img_read_ex would
+ * (resampling on the fly to the target size, and converting to the requested
+ * format). JPEG images are decoded incrementally, so only a band of rows is in
+ * memory at any time. Other formats are decoded whole first, and streamed from
+ * the decoded image.
+ */
+struct img_stream {
+	/* called once before any rows, with the size and format they'll have */
+	int (*begin)(int width, int height, enum img_fmt fmt, void *cls);
+	/* called with count consecutive, tightly packed rows, starting at row y.
+	 * The pixels are only valid until it returns.
+	 */
+	int (*rows)(const void *pixels, int y, int count, void *cls);
+	void *cls;
+};
+/* Either callback can return -1 to abort decoding, which then fails. */
+
+/* initializes img_load_opt with the default options */
+void img_load_opt_init(struct img_load_opt *opt);
+
+/* same as img_load and img_read, with additional load options (opt may be null) */
+int img_load_ex(struct img_pixmap *img, const char *fname, const struct img_load_opt *opt);
+int img_read_ex(struct img_pixmap *img, struct img_io *io, const struct img_load_opt *opt);
+
+/* decodes an image, passing it to the img_stream callbacks (opt may be null) */
+int img_load_stream(const char *fname, const struct img_load_opt *opt, const struct img_stream *st);
+int img_read_stream(struct img_io *io, const struct img_load_opt *opt, const struct img_stream *st);
+
 /* Reads an image from an open FILE* into the supplied pixmap */
 int img_read_file(struct img_pixmap *img, FILE *fp);
 /* Writes the supplied pixmap to an open FILE* */
@@ -130,9 +221,80 @@ int img_read(struct img_pixmap *img, struct img_io *io);
 /* Writes an image using user-defined file-i/o functions (see img_io_set_*) */
 int img_write(struct img_pixmap *img, struct img_io *io);
 
+/* Mipmap containers (.imip) hold an image in RGBA32, along with its mipmaps
+ * down to 1x1, ready to be uploaded as texture levels. Each level is stored at
+ * a page-aligned offset, either uncompressed, to be used in place from a
+ * mapping of the file, or compressed with LZ4. Loaded as a regular image, a
+ * container gives the smallest level at least as large as the target size.
+ */
+#define IMG_MIPMAP_LZ4	1	/* img_save_mipmap flag: compress levels with LZ4 */
+
+struct img_miplevel {
+	int width, height;
+	void *pixels;		/* null until img_mipmap_pixels is called, read-only */
+	long offset, size;	/* of the level data in the file */
+	int lz4;
+};
+
+struct img_mipmap {
+	int num_levels;
+	struct img_miplevel *level;
+	const unsigned char *data;	/* the whole file, mapped if possible */
+	long size;
+	int mapped;
+};
+
+/* Writes img and its mipmaps, generated with img_resample, as a mipmap
+ * container. flags can be 0 or IMG_MIPMAP_LZ4. Saving with img_save to a file
+ * with the .imip suffix writes uncompressed levels.
+ */
+int img_save_mipmap(struct img_pixmap *img, const char *fname, unsigned int flags);
+int img_write_mipmap(struct img_pixmap *img, struct img_io *io, unsigned int flags);
+
+/* opens a mipmap container, and reads its level table. Nothing else is read
+ * if fname isn't a mipmap container.
+ */
+int img_load_mipmap(struct img_mipmap *mip, const char *fname);
+/* returns the pixels of a level, decompressing it the first time if needed */
+void *img_mipmap_pixels(struct img_mipmap *mip, int level);
+void img_destroy_mipmap(struct img_mipmap *mip);
+
 /* Converts an image to the specified pixel format */
 int img_convert(struct img_pixmap *img, enum img_fmt tofmt);
 
+/* resampling filters for img_resize_ex and img_resample_ex */
+enum {
+	IMG_FILTER_AREA,		/* average of the covered pixels, for downscaling */
+	IMG_FILTER_BILINEAR,	/* tent filter, widened when downscaling */
+	IMG_FILTER_LANCZOS3		/* sharpest, for upscaling or high quality downscaling */
+};
+
+/* Resamples an image to the specified size, using an area filter. Intended for
+ * downscaling; packed pixel formats (RGB565) are not supported.
+ */
+int img_resize(struct img_pixmap *img, int width, int height);
+/* Same as img_resize, but leaves the source image intact, and writes the
+ * resampled image to dest
+ */
+int img_resample(struct img_pixmap *dest, struct img_pixmap *src, int width, int height);
+/* same as img_resize and img_resample, with a choice of filter (IMG_FILTER_*) */
+int img_resize_ex(struct img_pixmap *img, int width, int height, int filter);
+int img_resample_ex(struct img_pixmap *dest, struct img_pixmap *src, int width, int height, int filter);
+
+/* Sets the number of threads used by img_convert and img_resample on large
+ * images. 0 (the default) uses one per processor, 1 disables multithreading.
+ * The thread pool is sized the first time it's needed; later calls can only
+ * disable it.
+ */
+void img_set_num_threads(int n);
+
+/* Enables decoding image files in place from a memory mapping, instead of
+ * reading them with stdio (the default). Reading a mapped file which is
+ * truncated meanwhile raises SIGBUS, which is left to the application: only
+ * enable it for files which aren't modified in place, or handle the signal.
+ */
+void img_set_mmap(int enable);
+
 /* Converts an image from an integer pixel format to the corresponding floating point one */
 int img_to_float(struct img_pixmap *img);
 /* Converts an image from a floating point pixel format to the corresponding integer one */
@@ -145,6 +307,9 @@ int img_has_alpha(struct img_pixmap *img);
 /* Returns non-zero (true) if the supplied image is greyscale */
 int img_is_greyscale(struct img_pixmap *img);
 
+/* Returns the size of a pixel of the specified format, in bytes */
+int img_fmt_pixel_size(enum img_fmt fmt);
+
 
 /* don't use these for anything performance-critical */
 void img_setpixel(struct img_pixmap *img, int x, int y, void *pixel);
@@ -211,12 +376,23 @@ unsigned int img_gltexture_read(struct img_io *io);
  *
  * Note: if the user-supplied write function is buffered, make sure to flush
  * (or close the file) after img_write returns.
+ *
+ * Note: a struct img_io must be initialized with img_io_init (or
+ * img_io_set_mem) before use, so that any fields not set explicitly are
+ * valid.
  */
+void img_io_init(struct img_io *io);
 void img_io_set_user_data(struct img_io *io, void *uptr);
 void img_io_set_read_func(struct img_io *io, size_t (*read)(void*, size_t, void*));
 void img_io_set_write_func(struct img_io *io, size_t (*write)(void*, size_t, void*));
 void img_io_set_seek_func(struct img_io *io, long (*seek)(long, int, void*));
 
+/* Sets up io for reading an image from a memory buffer, which must remain valid
+ * until reading is done. io must not be copied, it's its own user-data pointer.
+ * img_load and img_load_ex read files this way too when img_set_mmap is on.
+ */
+void img_io_set_mem(struct img_io *io, const void *data, long size);
+
 
 #ifdef __cplusplus
 }
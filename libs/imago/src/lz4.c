@@ -0,0 +1,187 @@
+/*
+libimago - a multi-format image file input/output library.
+Copyright (C) 2010-2020 John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "lz4.h"
+#include "byteord.h"
+
+#define MIN_MATCH		4
+#define LAST_LITERALS	5	/* the last 5 bytes are always literals */
+#define MFLIMIT			12	/* the last match starts at least 12 bytes before the end */
+#define MAX_OFFSET		65535
+
+#define HASH_BITS		14
+#define HASH(x)			(((x) * 2654435761u) >> (32 - HASH_BITS))
+
+static unsigned char *put_length(unsigned char *op, long len);
+
+static uint32_t read32(const unsigned char *p)
+{
+	uint32_t x;
+	memcpy(&x, p, 4);
+	return x;
+}
+
+/* Greedy parser: matches are looked up in a hash table of the last position
+ * where each 4 byte sequence was seen, and extended as far as they go. The
+ * search skips ahead faster the longer it goes without finding a match, so
+ * incompressible data pass through quickly.
+ */
+long img_lz4_compress(void *dest, const void *src, long size)
+{
+	const unsigned char *in = src, *end = in + size;
+	const unsigned char *ip = in, *anchor = in, *ref;
+	const unsigned char *mflimit = end - MFLIMIT, *matchlimit = end - LAST_LITERALS;
+	unsigned char *op = dest, *token;
+	uint32_t seq, h, *htab;
+	long len, misses = 0;
+
+	if(size > MFLIMIT) {
+		if(!(htab = calloc(1 << HASH_BITS, sizeof *htab))) {
+			return -1;
+		}
+
+		while(ip <= mflimit) {
+			seq = read32(ip);
+			h = HASH(seq);
+			ref = in + htab[h];
+			htab[h] = ip - in;
+
+			if(ref >= ip || ip - ref > MAX_OFFSET || read32(ref) != seq) {
+				ip += 1 + (misses++ >> 6);
+				continue;
+			}
+			misses = 0;
+
+			while(ip > anchor && ref > in && ip[-1] == ref[-1]) {
+				ip--;
+				ref--;
+			}
+			len = MIN_MATCH;
+			while(ip + len < matchlimit && ip[len] == ref[len]) {
+				len++;
+			}
+
+			/* literals since the last match, followed by the match */
+			token = op++;
+			if(ip - anchor >= 15) {
+				*token = 15 << 4;
+				op = put_length(op, ip - anchor - 15);
+			} else {
+				*token = (ip - anchor) << 4;
+			}
+			memcpy(op, anchor, ip - anchor);
+			op += ip - anchor;
+
+			*op++ = (ip - ref) & 0xff;
+			*op++ = (ip - ref) >> 8;
+			if(len - MIN_MATCH >= 15) {
+				*token |= 15;
+				op = put_length(op, len - MIN_MATCH - 15);
+			} else {
+				*token |= len - MIN_MATCH;
+			}
+
+			ip += len;
+			anchor = ip;
+		}
+		free(htab);
+	}
+
+	/* the rest are literals, in a final sequence without a match */
+	len = end - anchor;
+	token = op++;
+	if(len >= 15) {
+		*token = 15 << 4;
+		op = put_length(op, len - 15);
+	} else {
+		*token = len << 4;
+	}
+	memcpy(op, anchor, len);
+	op += len;
+
+	return op - (unsigned char*)dest;
+}
+
+static unsigned char *put_length(unsigned char *op, long len)
+{
+	while(len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+long img_lz4_decompress(void *dest, long dest_size, const void *src, long size)
+{
+	const unsigned char *ip = src, *end = ip + size, *match;
+	unsigned char *op = dest, *oend = op + dest_size;
+	int token, c;
+	long len, offs, n;
+
+	while(ip < end) {
+		token = *ip++;
+
+		if((len = token >> 4) == 15) {
+			do {
+				if(ip >= end) return -1;
+				len += (c = *ip++);
+			} while(c == 255);
+		}
+		if(len > end - ip || len > oend - op) {
+			return -1;
+		}
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		if(ip >= end) break;	/* the last sequence has no match */
+
+		if(end - ip < 2) return -1;
+		offs = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if(offs == 0 || offs > op - (unsigned char*)dest) {
+			return -1;
+		}
+
+		if((len = token & 0xf) == 15) {
+			do {
+				if(ip >= end) return -1;
+				len += (c = *ip++);
+			} while(c == 255);
+		}
+		len += MIN_MATCH;
+		if(len > oend - op) {
+			return -1;
+		}
+
+		/* the match may overlap the output: the part copied so far repeats
+		 * with a period of offs, so it can be copied in growing chunks
+		 */
+		match = op - offs;
+		while(len > 0) {
+			n = op - match;
+			if(n > len) n = len;
+			memcpy(op, match, n);
+			op += n;
+			len -= n;
+		}
+	}
+	return op - (unsigned char*)dest;
+}
@@ -0,0 +1,39 @@
+/*
+libimago - a multi-format image file input/output library.
+Copyright (C) 2010-2020 John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef IMAGO_LZ4_H_
+#define IMAGO_LZ4_H_
+
+/* LZ4 block format compression, as described in lz4_Block_format.md of the
+ * reference implementation. Only single blocks are handled, without the frame
+ * format around them; the uncompressed size has to be stored separately.
+ */
+
+/* maximum size of the compressed data for size bytes of input */
+#define IMG_LZ4_BOUND(size)	((size) + (size) / 255 + 16)
+
+/* compresses size bytes from src, into dest which must have room for at least
+ * IMG_LZ4_BOUND(size) bytes. Returns the compressed size, or -1 on failure.
+ */
+long img_lz4_compress(void *dest, const void *src, long size);
+/* Decompresses size bytes of compressed data from src, into dest of size
+ * dest_size. Returns the decompressed size, or -1 if the data are invalid, or
+ * wouldn't fit in dest.
+ */
+long img_lz4_decompress(void *dest, long dest_size, const void *src, long size);
+
+#endif	/* IMAGO_LZ4_H_ */
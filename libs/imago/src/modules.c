@@ -1,8 +1,10 @@
 /* this file is generated by ./configure, do not edit */
 int img_register_jpeg();
 int img_register_lbm();
+int img_register_mip();
 int img_register_png();
 int img_register_ppm();
+int img_register_qoi();
 int img_register_rgbe();
 int img_register_tga();
 
@@ -10,8 +12,10 @@ void img_modules_init(void)
 {
 	img_register_jpeg();
 	img_register_lbm();
+	img_register_mip();
 	img_register_png();
 	img_register_ppm();
+	img_register_qoi();
 	img_register_rgbe();
 	img_register_tga();
 }
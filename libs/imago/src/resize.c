@@ -0,0 +1,722 @@
+/*
+libimago - a multi-format image file input/output library.
+Copyright (C) 2010-2020 John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include "imago2.h"
+#include "threads.h"
+#include "stream.h"
+
+/* SIMD kernels are selected at runtime, like those of img_convert (conv.c) */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RESIZE_X86
+#include <immintrin.h>
+#define TARGET(x)	__attribute__((target(x)))
+#endif
+
+#ifndef M_PI
+#define M_PI	3.14159265358979323846
+#endif
+
+/* source pixels contributing to a single destination pixel */
+struct span {
+	int start, count;
+	float *weight;
+};
+
+struct resample_job {
+	struct img_pixmap *src;
+	unsigned char *dest;
+	int width, nchan, isfloat;
+	struct span *xspans, *yspans;
+	int max_rows;			/* most source rows contributing to a destination row */
+	int failed;
+};
+
+/* streaming area filter, see img_resampler_push */
+struct img_resampler {
+	int src_width, src_height, width, height;
+	int nchan, pixelsz, isfloat;
+	struct span *xspans, *yspans;
+	float *acc[2];			/* current destination row, and the next one */
+	float *accbuf;
+	float *rows;			/* horizontally filtered source rows */
+	int max_rows;
+	unsigned char *src;		/* source rows being filtered */
+	unsigned char *out;		/* finished destination row */
+	int src_y, dest_y;
+	int (*emit)(void*, int, void*);
+	void *cls;
+};
+
+static int num_channels(enum img_fmt fmt);
+static struct span *calc_spans(int srcsz, int dstsz, int filter, int *max_count);
+static struct span *calc_area_spans(int srcsz, int dstsz, int *max_count);
+static float filter_weight(int filter, float x);
+static void resample_rows(int start, int end, void *cls);
+static void filter_rows(int start, int end, void *cls);
+static void filter_row(float *dest, void *src, int width, struct span *spans, int nchan, int isfloat);
+static void store_row(unsigned char *dest, float *acc, int count, int isfloat);
+static void accum_row_c(float *acc, const float *row, float w, int count);
+static void store_bytes_c(unsigned char *dest, const float *acc, int count);
+static void init_kernels(void);
+
+/* four channel rows are filtered a pixel at a time by SIMD kernels, if any */
+static void (*filter_row4)(float*, void*, int, struct span*, int);
+/* adds a horizontally filtered row, times its weight, to a destination row */
+static void (*accum_row)(float*, const float*, float, int) = accum_row_c;
+/* rounds and clamps accumulated values to bytes */
+static void (*store_bytes)(unsigned char*, const float*, int) = store_bytes_c;
+
+static pthread_once_t kern_once = PTHREAD_ONCE_INIT;
+#define INIT_KERNELS()	pthread_once(&kern_once, init_kernels)
+
+
+/* Area filter: each destination pixel is the average of the source pixels it
+ * covers, weighted by the fraction of their area which falls inside it.
+ * The image is filtered horizontally one source row at a time, and the rows
+ * are accumulated vertically into a single destination row, so no full-size
+ * intermediate buffer is needed. Large images are split into bands of
+ * destination rows, resampled in parallel.
+ */
+int img_resize(struct img_pixmap *img, int width, int height)
+{
+	return img_resize_ex(img, width, height, IMG_FILTER_AREA);
+}
+
+int img_resample(struct img_pixmap *dest, struct img_pixmap *img, int width, int height)
+{
+	return img_resample_ex(dest, img, width, height, IMG_FILTER_AREA);
+}
+
+/* The other filters work the same way, with wider spans of source pixels,
+ * weighted by the filter kernel. Horizontally filtered rows are kept in a ring
+ * buffer, because consecutive destination rows share most of their source rows.
+ */
+int img_resize_ex(struct img_pixmap *img, int width, int height, int filter)
+{
+	struct img_pixmap tmp;
+
+	if(width == img->width && height == img->height) {
+		return 0;
+	}
+
+	img_init(&tmp);
+	if(img_resample_ex(&tmp, img, width, height, filter) == -1) {
+		return -1;
+	}
+	free(img->pixels);
+	img->pixels = tmp.pixels;
+	img->width = width;
+	img->height = height;
+	return 0;
+}
+
+int img_resample_ex(struct img_pixmap *dest, struct img_pixmap *img, int width, int height, int filter)
+{
+	struct resample_job job;
+	unsigned char *newpix;
+
+	if(width <= 0 || height <= 0) {
+		return -1;
+	}
+
+	if((job.nchan = num_channels(img->fmt)) == -1) {
+		return -1;	/* packed formats are not supported */
+	}
+	job.isfloat = img_is_float(img);
+	INIT_KERNELS();
+
+	if(!(newpix = malloc(width * height * img->pixelsz))) {
+		return -1;
+	}
+	job.yspans = 0;
+	if(!(job.xspans = calc_spans(img->width, width, filter, 0)) ||
+			!(job.yspans = calc_spans(img->height, height, filter, &job.max_rows))) {
+		free(job.xspans);
+		free(newpix);
+		return -1;
+	}
+	job.src = img;
+	job.dest = newpix;
+	job.width = width;
+	job.failed = 0;
+
+	img_parallel_rows(height, width, resample_rows, &job);
+
+	free(job.xspans);
+	free(job.yspans);
+	if(job.failed) {
+		free(newpix);
+		return -1;
+	}
+
+	free(dest->pixels);
+	dest->pixels = newpix;
+	dest->width = width;
+	dest->height = height;
+	dest->fmt = img->fmt;
+	dest->pixelsz = img->pixelsz;
+	return 0;
+}
+
+/* resamples destination rows [start, end) */
+static void resample_rows(int start, int end, void *cls)
+{
+	struct resample_job *job = cls;
+	int i, j, y, slot, *row_y;
+	int width = job->width, nchan = job->nchan, n = width * nchan;
+	long rowsz;
+	float *acc, *rows, *row;
+	unsigned char *srcpix = job->src->pixels;
+	unsigned char *dptr = job->dest + start * width * job->src->pixelsz;
+
+	/* source row y is kept in slot y % max_rows */
+	if(!(acc = malloc(n * (job->max_rows + 1) * sizeof *acc))) {
+		job->failed = 1;
+		return;
+	}
+	if(!(row_y = malloc(job->max_rows * sizeof *row_y))) {
+		free(acc);
+		job->failed = 1;
+		return;
+	}
+	for(i=0; i<job->max_rows; i++) {
+		row_y[i] = -1;
+	}
+	rows = acc + n;
+	rowsz = job->src->width * job->src->pixelsz;
+
+	for(i=start; i<end; i++) {
+		struct span *sp = job->yspans + i;
+
+		memset(acc, 0, n * sizeof *acc);
+		for(j=0; j<sp->count; j++) {
+			float w = sp->weight[j];
+
+			y = sp->start + j;
+			slot = y % job->max_rows;
+			row = rows + slot * n;
+			if(row_y[slot] != y) {
+				filter_row(row, srcpix + y * rowsz, width, job->xspans, nchan, job->isfloat);
+				row_y[slot] = y;
+			}
+			accum_row(acc, row, w, n);
+		}
+
+		store_row(dptr, acc, n, job->isfloat);
+		dptr += width * job->src->pixelsz;
+	}
+
+	free(row_y);
+	free(acc);
+}
+
+/* The streaming variant gets the source rows in order, a band at a time. Each
+ * band is filtered horizontally in parallel, and the rows are accumulated into
+ * the destination rows they cover. When downscaling, a source row contributes
+ * to at most two destination rows: the last row of one can be the first of
+ * the next. The result is identical to img_resample.
+ */
+struct img_resampler *img_resampler_create(int src_width, int src_height, int width, int height,
+		enum img_fmt fmt, int (*emit)(void*, int, void*), void *cls)
+{
+	struct img_resampler *rs;
+	int nchan;
+
+	if(width <= 0 || height <= 0 || width > src_width || height > src_height ||
+			(nchan = num_channels(fmt)) == -1) {
+		return 0;
+	}
+	if(!(rs = calloc(1, sizeof *rs))) {
+		return 0;
+	}
+	INIT_KERNELS();
+	rs->src_width = src_width;
+	rs->src_height = src_height;
+	rs->width = width;
+	rs->height = height;
+	rs->nchan = nchan;
+	rs->pixelsz = img_fmt_pixel_size(fmt);
+	rs->isfloat = fmt == IMG_FMT_GREYF || fmt == IMG_FMT_RGBF || fmt == IMG_FMT_RGBAF;
+	rs->emit = emit;
+	rs->cls = cls;
+
+	if(!(rs->xspans = calc_area_spans(src_width, width, 0)) ||
+			!(rs->yspans = calc_area_spans(src_height, height, 0)) ||
+			!(rs->accbuf = calloc(width * nchan * 2, sizeof *rs->accbuf)) ||
+			!(rs->out = malloc(width * rs->pixelsz))) {
+		img_resampler_destroy(rs);
+		return 0;
+	}
+	rs->acc[0] = rs->accbuf;
+	rs->acc[1] = rs->accbuf + width * nchan;
+	return rs;
+}
+
+void img_resampler_destroy(struct img_resampler *rs)
+{
+	if(!rs) return;
+	free(rs->xspans);
+	free(rs->yspans);
+	free(rs->accbuf);
+	free(rs->rows);
+	free(rs->out);
+	free(rs);
+}
+
+int img_resampler_push(struct img_resampler *rs, void *pixels, int count)
+{
+	int i, y, n = rs->width * rs->nchan;
+	float *row, *tmp;
+	struct span *sp;
+
+	if(count > rs->max_rows) {
+		if(!(tmp = realloc(rs->rows, count * n * sizeof *tmp))) {
+			return -1;
+		}
+		rs->rows = tmp;
+		rs->max_rows = count;
+	}
+	rs->src = pixels;
+	img_parallel_rows(count, rs->src_width, filter_rows, rs);
+
+	for(i=0; i<count && rs->dest_y < rs->height; i++) {
+		y = rs->src_y++;
+		row = rs->rows + i * n;
+		sp = rs->yspans + rs->dest_y;
+
+		accum_row(rs->acc[0], row, sp->weight[y - sp->start], n);
+		if(rs->dest_y + 1 < rs->height && y >= sp[1].start) {
+			accum_row(rs->acc[1], row, sp[1].weight[y - sp[1].start], n);
+		}
+
+		if(y >= sp->start + sp->count - 1) {
+			store_row(rs->out, rs->acc[0], n, rs->isfloat);
+			if(rs->emit(rs->out, rs->dest_y++, rs->cls) == -1) {
+				return -1;
+			}
+			tmp = rs->acc[0];
+			rs->acc[0] = rs->acc[1];
+			rs->acc[1] = tmp;
+			memset(tmp, 0, n * sizeof *tmp);
+		}
+	}
+	return 0;
+}
+
+/* horizontally filters rows [start, end) of the band being pushed */
+static void filter_rows(int start, int end, void *cls)
+{
+	int i;
+	struct img_resampler *rs = cls;
+	long src_rowsz = rs->src_width * rs->pixelsz;
+
+	for(i=start; i<end; i++) {
+		filter_row(rs->rows + i * rs->width * rs->nchan, rs->src + i * src_rowsz,
+				rs->width, rs->xspans, rs->nchan, rs->isfloat);
+	}
+}
+
+static int num_channels(enum img_fmt fmt)
+{
+	switch(fmt) {
+	case IMG_FMT_GREY8:
+	case IMG_FMT_GREYF:
+		return 1;
+	case IMG_FMT_RGB24:
+	case IMG_FMT_RGBF:
+		return 3;
+	case IMG_FMT_RGBA32:
+	case IMG_FMT_BGRA32:
+	case IMG_FMT_RGBAF:
+		return 4;
+	default:
+		break;
+	}
+	return -1;
+}
+
+/* Spans of the filter kernel around the center of each destination pixel,
+ * widened by the downscaling factor, so that every source pixel contributes.
+ * Taps falling outside the image are dropped, and the rest renormalized.
+ * max_count, if not null, is set to the largest number of taps of any span.
+ */
+static struct span *calc_spans(int srcsz, int dstsz, int filter, int *max_count)
+{
+	int i, j, start, end, maxc, count;
+	struct span *spans;
+	float *wptr, center, sum;
+	float scale = (float)srcsz / (float)dstsz;
+	float fscale = scale > 1.0f ? scale : 1.0f;
+	float radius;
+
+	switch(filter) {
+	case IMG_FILTER_BILINEAR:
+		radius = fscale;
+		break;
+	case IMG_FILTER_LANCZOS3:
+		radius = 3.0f * fscale;
+		break;
+	default:
+		return calc_area_spans(srcsz, dstsz, max_count);
+	}
+
+	maxc = (int)ceil(radius * 2.0f) + 1;
+	if(!(spans = malloc(dstsz * (sizeof *spans + maxc * sizeof *wptr)))) {
+		return 0;
+	}
+	wptr = (float*)(spans + dstsz);
+	if(max_count) *max_count = 1;
+
+	for(i=0; i<dstsz; i++) {
+		center = (i + 0.5f) * scale - 0.5f;
+		start = (int)ceil(center - radius);
+		end = (int)floor(center + radius) + 1;
+		if(start < 0) start = 0;
+		if(end > srcsz) end = srcsz;
+		if(end - start > maxc) end = start + maxc;
+		if(end <= start) {
+			start = center < 0.0f ? 0 : (int)(center + 0.5f);
+			if(start >= srcsz) start = srcsz - 1;
+			end = start + 1;
+		}
+		count = end - start;
+
+		spans[i].start = start;
+		spans[i].count = count;
+		spans[i].weight = wptr;
+
+		sum = 0.0f;
+		for(j=0; j<count; j++) {
+			wptr[j] = filter_weight(filter, (start + j - center) / fscale);
+			sum += wptr[j];
+		}
+		for(j=0; j<count; j++) {
+			wptr[j] = sum != 0.0f ? wptr[j] / sum : 1.0f / count;
+		}
+		wptr += count;
+
+		if(max_count && count > *max_count) {
+			*max_count = count;
+		}
+	}
+	return spans;
+}
+
+static float filter_weight(int filter, float x)
+{
+	if(x < 0.0f) x = -x;
+
+	switch(filter) {
+	case IMG_FILTER_BILINEAR:
+		return x < 1.0f ? 1.0f - x : 0.0f;
+
+	case IMG_FILTER_LANCZOS3:
+		if(x < 1e-5f) return 1.0f;
+		if(x >= 3.0f) return 0.0f;
+		x *= M_PI;
+		return 3.0f * sin(x) * sin(x / 3.0f) / (x * x);
+
+	default:
+		break;
+	}
+	return 0.0f;
+}
+
+/* the spans and their weights are allocated in a single block */
+static struct span *calc_area_spans(int srcsz, int dstsz, int *max_count)
+{
+	int i, j, maxc;
+	struct span *spans;
+	float *wptr;
+	float scale = (float)srcsz / (float)dstsz;
+
+	maxc = (int)ceil(scale) + 1;
+	if(!(spans = malloc(dstsz * (sizeof *spans + maxc * sizeof *wptr)))) {
+		return 0;
+	}
+	wptr = (float*)(spans + dstsz);
+	if(max_count) *max_count = maxc;
+
+	for(i=0; i<dstsz; i++) {
+		float x0 = i * scale;
+		float x1 = x0 + scale;
+		int end = (int)ceil(x1);
+		float sum = 0.0f;
+
+		spans[i].start = (int)x0;
+		if(end > srcsz) end = srcsz;
+		if(end <= spans[i].start) end = spans[i].start + 1;
+		spans[i].count = end - spans[i].start;
+		spans[i].weight = wptr;
+
+		for(j=0; j<spans[i].count; j++) {
+			float a = spans[i].start + j;
+			float b = a + 1.0f;
+			if(a < x0) a = x0;
+			if(b > x1) b = x1;
+			wptr[j] = b > a ? b - a : 0.0f;
+			sum += wptr[j];
+		}
+		/* normalize, to account for rounding and upscaling */
+		for(j=0; j<spans[i].count; j++) {
+			wptr[j] = sum > 0.0f ? wptr[j] / sum : 1.0f / spans[i].count;
+		}
+		wptr += spans[i].count;
+	}
+	return spans;
+}
+
+static void filter_row(float *dest, void *src, int width, struct span *spans, int nchan, int isfloat)
+{
+	int i, j, k;
+
+	if(nchan == 4 && filter_row4) {
+		filter_row4(dest, src, width, spans, isfloat);
+		return;
+	}
+
+	for(i=0; i<width; i++) {
+		struct span *sp = spans + i;
+
+		for(k=0; k<nchan; k++) {
+			dest[k] = 0.0f;
+		}
+
+		if(isfloat) {
+			float *sptr = (float*)src + sp->start * nchan;
+			for(j=0; j<sp->count; j++) {
+				for(k=0; k<nchan; k++) {
+					dest[k] += *sptr++ * sp->weight[j];
+				}
+			}
+		} else {
+			unsigned char *sptr = (unsigned char*)src + sp->start * nchan;
+			for(j=0; j<sp->count; j++) {
+				for(k=0; k<nchan; k++) {
+					dest[k] += *sptr++ * sp->weight[j];
+				}
+			}
+		}
+		dest += nchan;
+	}
+}
+
+/* stores a row of accumulated values in the integer or float pixel format,
+ * clamped to [0, 255], since filters with negative lobes overshoot both ways.
+ */
+static void store_row(unsigned char *dest, float *acc, int count, int isfloat)
+{
+	if(isfloat) {
+		memcpy(dest, acc, count * sizeof *acc);
+		return;
+	}
+	store_bytes(dest, acc, count);
+}
+
+static void accum_row_c(float *acc, const float *row, float w, int count)
+{
+	int i;
+
+	for(i=0; i<count; i++) {
+		acc[i] += row[i] * w;
+	}
+}
+
+static void store_bytes_c(unsigned char *dest, const float *acc, int count)
+{
+	int i, val;
+
+	for(i=0; i<count; i++) {
+		val = (int)(acc[i] + 0.5f);
+		dest[i] = val > 255 ? 255 : (val < 0 ? 0 : val);
+	}
+}
+
+#ifdef RESIZE_X86
+/* Four channel pixels fit in a vector, and are filtered a whole pixel at a
+ * time, in the same order as filter_row, to get identical results. The AVX2
+ * variant filters two pixels at once, one in each half, while both of their
+ * spans last.
+ */
+static TARGET("sse2") void filter_row4_sse2(float *dest, void *src, int width, struct span *spans, int isfloat)
+{
+	int i, j, pix;
+	__m128 sum, val;
+	__m128i zero = _mm_setzero_si128();
+
+	for(i=0; i<width; i++) {
+		struct span *sp = spans + i;
+
+		sum = _mm_setzero_ps();
+		if(isfloat) {
+			float *sptr = (float*)src + sp->start * 4;
+			for(j=0; j<sp->count; j++) {
+				val = _mm_loadu_ps(sptr);
+				sum = _mm_add_ps(sum, _mm_mul_ps(val, _mm_set1_ps(sp->weight[j])));
+				sptr += 4;
+			}
+		} else {
+			unsigned char *sptr = (unsigned char*)src + sp->start * 4;
+			for(j=0; j<sp->count; j++) {
+				memcpy(&pix, sptr, 4);
+				val = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(pix), zero), zero));
+				sum = _mm_add_ps(sum, _mm_mul_ps(val, _mm_set1_ps(sp->weight[j])));
+				sptr += 4;
+			}
+		}
+		_mm_storeu_ps(dest, sum);
+		dest += 4;
+	}
+}
+
+static TARGET("sse2") void accum_row_sse2(float *acc, const float *row, float w, int count)
+{
+	int i;
+	__m128 wv = _mm_set1_ps(w);
+
+	for(i=0; i<=count - 4; i+=4) {
+		_mm_storeu_ps(acc + i, _mm_add_ps(_mm_loadu_ps(acc + i), _mm_mul_ps(_mm_loadu_ps(row + i), wv)));
+	}
+	accum_row_c(acc + i, row + i, w, count - i);
+}
+
+static TARGET("sse2") void store_bytes_sse2(unsigned char *dest, const float *acc, int count)
+{
+	int i;
+	__m128 half = _mm_set1_ps(0.5f);
+	__m128i v0, v1, v2, v3;
+
+	for(i=0; i<=count - 16; i+=16) {
+		v0 = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(acc + i), half));
+		v1 = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(acc + i + 4), half));
+		v2 = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(acc + i + 8), half));
+		v3 = _mm_cvttps_epi32(_mm_add_ps(_mm_loadu_ps(acc + i + 12), half));
+		/* saturating packs do the clamping */
+		v0 = _mm_packus_epi16(_mm_packs_epi32(v0, v1), _mm_packs_epi32(v2, v3));
+		_mm_storeu_si128((__m128i*)(dest + i), v0);
+	}
+	store_bytes_c(dest + i, acc + i, count - i);
+}
+
+/* loads the 4 channels of pixel idx of a row, as floats */
+static TARGET("avx2") __m128 load_pixel4(void *src, int idx, int isfloat)
+{
+	int pix;
+
+	if(isfloat) {
+		return _mm_loadu_ps((float*)src + idx * 4);
+	}
+	memcpy(&pix, (unsigned char*)src + idx * 4, 4);
+	return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(pix)));
+}
+
+static TARGET("avx2") void filter_row4_avx2(float *dest, void *src, int width, struct span *spans, int isfloat)
+{
+	int i, j, n, pix[2];
+	__m256 sum, val;
+	__m128 lo, hi;
+
+	for(i=0; i<=width - 2; i+=2) {
+		struct span *sp = spans + i;
+
+		n = sp[0].count < sp[1].count ? sp[0].count : sp[1].count;
+		sum = _mm256_setzero_ps();
+		for(j=0; j<n; j++) {
+			if(isfloat) {
+				val = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps((float*)src + (sp[0].start + j) * 4)),
+						_mm_loadu_ps((float*)src + (sp[1].start + j) * 4), 1);
+			} else {
+				memcpy(pix, (unsigned char*)src + (sp[0].start + j) * 4, 4);
+				memcpy(pix + 1, (unsigned char*)src + (sp[1].start + j) * 4, 4);
+				val = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i*)pix)));
+			}
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(val, _mm256_setr_ps(sp[0].weight[j], sp[0].weight[j],
+							sp[0].weight[j], sp[0].weight[j], sp[1].weight[j], sp[1].weight[j],
+							sp[1].weight[j], sp[1].weight[j])));
+		}
+
+		/* the rest of the longer span */
+		lo = _mm256_castps256_ps128(sum);
+		hi = _mm256_extractf128_ps(sum, 1);
+		for(j=n; j<sp[0].count; j++) {
+			lo = _mm_add_ps(lo, _mm_mul_ps(load_pixel4(src, sp[0].start + j, isfloat), _mm_set1_ps(sp[0].weight[j])));
+		}
+		for(j=n; j<sp[1].count; j++) {
+			hi = _mm_add_ps(hi, _mm_mul_ps(load_pixel4(src, sp[1].start + j, isfloat), _mm_set1_ps(sp[1].weight[j])));
+		}
+		_mm_storeu_ps(dest, lo);
+		_mm_storeu_ps(dest + 4, hi);
+		dest += 8;
+	}
+	if(i < width) {
+		filter_row4_sse2(dest, src, width - i, spans + i, isfloat);
+	}
+}
+
+static TARGET("avx2") void accum_row_avx2(float *acc, const float *row, float w, int count)
+{
+	int i;
+	__m256 wv = _mm256_set1_ps(w);
+
+	for(i=0; i<=count - 8; i+=8) {
+		_mm256_storeu_ps(acc + i, _mm256_add_ps(_mm256_loadu_ps(acc + i),
+					_mm256_mul_ps(_mm256_loadu_ps(row + i), wv)));
+	}
+	accum_row_c(acc + i, row + i, w, count - i);
+}
+
+static TARGET("avx2") void store_bytes_avx2(unsigned char *dest, const float *acc, int count)
+{
+	int i;
+	__m256 half = _mm256_set1_ps(0.5f);
+	__m256i v0, v1, v2, v3;
+	/* the packs work within each 128bit half, this puts the dwords back in order */
+	__m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	for(i=0; i<=count - 32; i+=32) {
+		v0 = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_loadu_ps(acc + i), half));
+		v1 = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_loadu_ps(acc + i + 8), half));
+		v2 = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_loadu_ps(acc + i + 16), half));
+		v3 = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_loadu_ps(acc + i + 24), half));
+		v0 = _mm256_packus_epi16(_mm256_packs_epi32(v0, v1), _mm256_packs_epi32(v2, v3));
+		_mm256_storeu_si256((__m256i*)(dest + i), _mm256_permutevar8x32_epi32(v0, order));
+	}
+	store_bytes_sse2(dest + i, acc + i, count - i);
+}
+#endif	/* RESIZE_X86 */
+
+/* picks the best kernels supported by the CPU we're running on */
+static void init_kernels(void)
+{
+#ifdef RESIZE_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("sse2")) {
+		filter_row4 = filter_row4_sse2;
+		accum_row = accum_row_sse2;
+		store_bytes = store_bytes_sse2;
+	}
+	if(__builtin_cpu_supports("avx2")) {
+		filter_row4 = filter_row4_avx2;
+		accum_row = accum_row_avx2;
+		store_bytes = store_bytes_avx2;
+	}
+#endif
+}
@@ -0,0 +1,144 @@
+/*
+libimago - a multi-format image file input/output library.
+Copyright (C) 2010-2020 John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include "imago2.h"
+#include "stream.h"
+
+struct img_rowstream {
+	int width, height;
+	enum img_fmt fmt;				/* rows pushed by the decoder */
+	int out_width, out_height;
+	enum img_fmt out_fmt;			/* rows passed to the callbacks */
+	struct img_resampler *rsmp;		/* null if the size doesn't change */
+	unsigned char *conv;			/* converted rows, if the format changes */
+	int conv_rows;
+	int next_row;					/* next output row */
+	const struct img_stream *st;
+};
+
+static int emit_rows(void *pixels, int y, int count, struct img_rowstream *rs);
+static int emit_row(void *pixels, int y, void *cls);
+static int pixmap_begin(int width, int height, enum img_fmt fmt, void *cls);
+static int pixmap_rows(const void *pixels, int y, int count, void *cls);
+
+
+struct img_rowstream *img_rowstream_begin(int width, int height, enum img_fmt fmt,
+		int out_width, int out_height, int out_fmt, const struct img_stream *st)
+{
+	struct img_rowstream *rs;
+
+	if(!(rs = calloc(1, sizeof *rs))) {
+		return 0;
+	}
+	rs->width = width;
+	rs->height = height;
+	rs->fmt = fmt;
+	rs->out_width = out_width < width ? out_width : width;
+	rs->out_height = out_height < height ? out_height : height;
+	rs->out_fmt = out_fmt >= 0 ? out_fmt : fmt;
+	rs->st = st;
+
+	if(rs->out_width != width || rs->out_height != height) {
+		if(!(rs->rsmp = img_resampler_create(width, height, rs->out_width, rs->out_height,
+						fmt, emit_row, rs))) {
+			free(rs);
+			return 0;
+		}
+	}
+
+	if(st->begin(rs->out_width, rs->out_height, rs->out_fmt, st->cls) == -1) {
+		img_resampler_destroy(rs->rsmp);
+		free(rs);
+		return 0;
+	}
+	return rs;
+}
+
+int img_rowstream_push(struct img_rowstream *rs, void *pixels, int count)
+{
+	if(rs->rsmp) {
+		return img_resampler_push(rs->rsmp, pixels, count);
+	}
+	if(rs->next_row + count > rs->out_height) {
+		count = rs->out_height - rs->next_row;
+	}
+	return emit_rows(pixels, rs->next_row, count, rs);
+}
+
+int img_rowstream_end(struct img_rowstream *rs)
+{
+	int res = rs->next_row < rs->out_height ? -1 : 0;
+
+	img_resampler_destroy(rs->rsmp);
+	free(rs->conv);
+	free(rs);
+	return res;
+}
+
+void img_stream_pixmap(struct img_stream *st, struct img_pixmap *img)
+{
+	st->begin = pixmap_begin;
+	st->rows = pixmap_rows;
+	st->cls = img;
+}
+
+/* converts rows to the output format if necessary, and passes them on */
+static int emit_rows(void *pixels, int y, int count, struct img_rowstream *rs)
+{
+	unsigned char *tmp;
+	int pixsz;
+
+	if(count <= 0) return 0;
+
+	if(rs->out_fmt != rs->fmt) {
+		if(count > rs->conv_rows) {
+			pixsz = img_fmt_pixel_size(rs->out_fmt);
+			if(!(tmp = realloc(rs->conv, count * rs->out_width * pixsz))) {
+				return -1;
+			}
+			rs->conv = tmp;
+			rs->conv_rows = count;
+		}
+		img_convert_pixels(rs->conv, rs->out_fmt, pixels, rs->fmt, count * rs->out_width);
+		pixels = rs->conv;
+	}
+
+	rs->next_row = y + count;
+	return rs->st->rows(pixels, y, count, rs->st->cls);
+}
+
+/* called by the resampler for each finished row */
+static int emit_row(void *pixels, int y, void *cls)
+{
+	return emit_rows(pixels, y, 1, cls);
+}
+
+static int pixmap_begin(int width, int height, enum img_fmt fmt, void *cls)
+{
+	return img_alloc_pixels(cls, width, height, fmt);
+}
+
+static int pixmap_rows(const void *pixels, int y, int count, void *cls)
+{
+	struct img_pixmap *img = cls;
+	long rowsz = img->width * img->pixelsz;
+
+	memcpy((char*)img->pixels + y * rowsz, pixels, count * rowsz);
+	return 0;
+}
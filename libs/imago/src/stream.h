@@ -0,0 +1,72 @@
+/*
+libimago - a multi-format image file input/output library.
+Copyright (C) 2010-2020 John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef IMAGO_STREAM_H_
+#define IMAGO_STREAM_H_
+
+#include "imago2.h"
+
+/* Row streams connect incremental decoders to the img_stream callbacks. The
+ * decoder pushes rows at the size and in the format it decodes to, which are
+ * resampled to the output size on the fly, and converted to the output format,
+ * as needed. Only downscaling is supported.
+ */
+struct img_rowstream;
+
+/* calls st->begin, out_fmt -1 keeps the format of the decoder */
+struct img_rowstream *img_rowstream_begin(int width, int height, enum img_fmt fmt,
+		int out_width, int out_height, int out_fmt, const struct img_stream *st);
+/* passes the next count rows of the decoded image */
+int img_rowstream_push(struct img_rowstream *rs, void *pixels, int count);
+/* frees the row stream, returns -1 if the output is incomplete */
+int img_rowstream_end(struct img_rowstream *rs);
+
+/* sets up st to store the rows it receives in img */
+void img_stream_pixmap(struct img_stream *st, struct img_pixmap *img);
+
+/* Streaming area filter (resize.c): source rows are pushed from top to bottom,
+ * and each destination row is passed to emit as soon as it's complete.
+ */
+struct img_resampler;
+
+struct img_resampler *img_resampler_create(int src_width, int src_height, int width, int height,
+		enum img_fmt fmt, int (*emit)(void *row, int y, void *cls), void *cls);
+void img_resampler_destroy(struct img_resampler *rs);
+int img_resampler_push(struct img_resampler *rs, void *pixels, int count);
+
+/* converts count pixels from one format to another (conv.c) */
+void img_convert_pixels(void *dest, enum img_fmt dest_fmt, void *src, enum img_fmt src_fmt, int count);
+
+/* parameters of img_rgbe_to_rgba */
+struct img_rgbe_conv {
+	const float *scale;			/* multiplier for each exponent */
+	int tonemap;				/* IMG_TONEMAP_* */
+	const unsigned char *gamma;	/* gamma correction table for tone mapped values */
+	int gamma_size;
+	int bgra;					/* pack to BGRA32 instead of RGBA32 */
+};
+
+/* RGBE decoding kernels (conv.c). src holds count pixels of a scanline with
+ * separate R, G, B and E channels, each width bytes long. img_rgbe_to_float
+ * converts them to RGB floats, and img_rgbe_to_rgba tone maps them to 8 bits.
+ * SIMD variants are selected at runtime, like those of img_convert.
+ */
+void img_rgbe_to_float(float *dest, const unsigned char *src, int count, int width, const float *scale);
+void img_rgbe_to_rgba(unsigned char *dest, const unsigned char *src, int count, int width,
+		const struct img_rgbe_conv *rc);
+
+#endif	/* IMAGO_STREAM_H_ */
@@ -0,0 +1,149 @@
+/*
+libimago - a multi-format image file input/output library.
+Copyright (C) 2010-2020 John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "imago2.h"
+#include "threads.h"
+
+#define MAX_THREADS		32
+/* bands per thread, to balance the load when some threads start late */
+#define BANDS_PER_THREAD	4
+
+struct job {
+	void (*func)(int, int, void*);
+	void *cls;
+	int rows, band_rows, num_bands;
+	int next_band;
+	int active;			/* workers which haven't finished with this job yet */
+	unsigned int gen;	/* incremented for every new job */
+};
+
+static void start_pool(void);
+static void *worker(void *arg);
+static void process_bands(void);
+
+static int req_threads;
+static int num_workers = -1;	/* -1 until the pool is started */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t job_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static struct job job;
+
+
+void img_set_num_threads(int n)
+{
+	req_threads = n;
+}
+
+void img_parallel_rows(int rows, int width, void (*func)(int, int, void*), void *cls)
+{
+	if(rows < 2 || (long)rows * width < IMG_MT_THRESHOLD || req_threads == 1 ||
+			pthread_mutex_trylock(&pool_lock) != 0) {
+		func(0, rows, cls);
+		return;
+	}
+
+	if(num_workers < 0) {
+		start_pool();
+	}
+	if(num_workers == 0) {
+		pthread_mutex_unlock(&pool_lock);
+		func(0, rows, cls);
+		return;
+	}
+
+	pthread_mutex_lock(&job_lock);
+	job.func = func;
+	job.cls = cls;
+	job.rows = rows;
+	job.num_bands = (num_workers + 1) * BANDS_PER_THREAD;
+	if(job.num_bands > rows) job.num_bands = rows;
+	job.band_rows = (rows + job.num_bands - 1) / job.num_bands;
+	job.num_bands = (rows + job.band_rows - 1) / job.band_rows;
+	job.next_band = 0;
+	job.active = num_workers;
+	job.gen++;
+	pthread_cond_broadcast(&job_cond);
+
+	process_bands();
+	while(job.active > 0) {
+		pthread_cond_wait(&done_cond, &job_lock);
+	}
+	pthread_mutex_unlock(&job_lock);
+	pthread_mutex_unlock(&pool_lock);
+}
+
+/* called with pool_lock held. The workers keep running until the process exits */
+static void start_pool(void)
+{
+	int i, n = req_threads;
+
+	if(n <= 0) {
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if(n > MAX_THREADS) n = MAX_THREADS;
+
+	num_workers = 0;
+	for(i=0; i<n - 1; i++) {
+		pthread_t thr;
+		if(pthread_create(&thr, 0, worker, 0) != 0) {
+			fprintf(stderr, "libimago: failed to create worker thread\n");
+			break;
+		}
+		pthread_detach(thr);
+		num_workers++;
+	}
+}
+
+static void *worker(void *arg)
+{
+	unsigned int gen = 0;
+
+	pthread_mutex_lock(&job_lock);
+	for(;;) {
+		while(job.gen == gen) {
+			pthread_cond_wait(&job_cond, &job_lock);
+		}
+		gen = job.gen;
+
+		process_bands();
+		if(--job.active == 0) {
+			pthread_cond_signal(&done_cond);
+		}
+	}
+	return 0;
+}
+
+/* called with job_lock held, which is released while running func */
+static void process_bands(void)
+{
+	int start, end;
+
+	while(job.next_band < job.num_bands) {
+		start = job.next_band++ * job.band_rows;
+		end = start + job.band_rows;
+		if(end > job.rows) end = job.rows;
+
+		pthread_mutex_unlock(&job_lock);
+		job.func(start, end, job.cls);
+		pthread_mutex_lock(&job_lock);
+	}
+}
@@ -0,0 +1,31 @@
+/*
+libimago - a multi-format image file input/output library.
+Copyright (C) 2010-2020 John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published
+by the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef IMAGO_THREADS_H_
+#define IMAGO_THREADS_H_
+
+/* images with fewer pixels than this are processed on the calling thread */
+#define IMG_MT_THRESHOLD	(512 * 512)
+
+/* Calls func(start, end, cls) for bands of consecutive rows covering [0, rows),
+ * spread across the thread pool and the calling thread, and returns when all of
+ * them are done. Runs func(0, rows, cls) directly if the image is below the
+ * threshold, or if the pool is busy with another image.
+ */
+void img_parallel_rows(int rows, int width, void (*func)(int, int, void*), void *cls);
+
+#endif	/* IMAGO_THREADS_H_ */
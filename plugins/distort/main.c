@@ -186,6 +186,11 @@ static void draw(long tmsec, void *cls)
 		if((img = xlivebg_bg_image(i)) && img->tex) {
 			struct xlivebg_image *amask = xlivebg_anim_mask(i);
 
+			/* the mask is sampled on the CPU */
+			if(amask && !xlivebg_image_pixels(amask)) {
+				amask = 0;
+			}
+
 			xlivebg_calc_image_proj(i, (float)img->width / img->height, xform);
 			glMatrixMode(GL_PROJECTION);
 			glLoadMatrixf(xform);
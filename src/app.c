@@ -21,6 +21,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <dlfcn.h>
 #include "app.h"
 #include "imageman.h"
+#include "slideshow.h"
 #include "plugin.h"
 #include "cfg.h"
 
@@ -93,6 +94,10 @@ void app_draw(void)
 {
 	struct xlivebg_plugin *plugin = get_active_plugin();
 
+	slideshow_update();
+	update_image_uploads();
+	update_crossfades();
+
 	if(plugin) {
 		plugin->draw(msec, plugin->data);
 	} else {
@@ -2,9 +2,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include "treestore.h"
+#include "imago2.h"
 #include "cfg.h"
+#include "app.h"
 #include "util.h"
 
+static void read_screen_cfg(struct ts_node *root);
+
 struct cfg cfg;
 char *cfgpath;
 
@@ -18,6 +22,14 @@ void init_cfg(void)
 	/* init default state */
 	memset(&cfg, 0, sizeof cfg);
 	cfg.fps_override = -1;
+	cfg.cache_ram = DEF_CACHE_RAM;
+	cfg.cache_vram = DEF_CACHE_VRAM;
+	cfg.disk_cache = 1;
+	cfg.disk_cache_size = DEF_DISK_CACHE_SIZE;
+	cfg.slideshow_interval = DEF_SLIDESHOW_INTERVAL;
+	cfg.xfade_time = DEF_XFADE_TIME;
+	cfg.preview = 1;
+	cfg.hdr_exposure = 1.0f;
 
 	/* load a config file if there is one */
 	if(!(cfgpath = get_config_path())) {
@@ -73,9 +85,108 @@ void init_cfg(void)
 	cfg.crop_dir[0] = vec[0];
 	cfg.crop_dir[1] = vec[1];
 
+	cfg.cache_ram = ts_lookup_int(ts, CFGNAME_CACHE_RAM, DEF_CACHE_RAM);
+	cfg.cache_vram = ts_lookup_int(ts, CFGNAME_CACHE_VRAM, DEF_CACHE_VRAM);
+	cfg.disk_cache = ts_lookup_int(ts, CFGNAME_DISK_CACHE, 1);
+	cfg.disk_cache_size = ts_lookup_int(ts, CFGNAME_DISK_CACHE_SIZE, DEF_DISK_CACHE_SIZE);
+	if((str = ts_lookup_str(ts, CFGNAME_SHARED_CACHE, 0))) {
+		cfg.shared_cache = strdup(str);
+	}
+	if((str = ts_lookup_str(ts, CFGNAME_SHARED_CACHE_OWNER, 0))) {
+		cfg.shared_cache_owner = strdup(str);
+	}
+	cfg.slideshow_interval = ts_lookup_int(ts, CFGNAME_SLIDESHOW_INTERVAL, DEF_SLIDESHOW_INTERVAL);
+	cfg.xfade_time = ts_lookup_num(ts, CFGNAME_XFADE_TIME, DEF_XFADE_TIME);
+	cfg.compact_tex = ts_lookup_int(ts, CFGNAME_COMPACT_TEX, 0);
+	cfg.preview = ts_lookup_int(ts, CFGNAME_PREVIEW, 1);
+	if((str = ts_lookup_str(ts, CFGNAME_HDR_TONEMAP, 0))) {
+		cfg.hdr_tonemap = cfg_parse_tonemap(str);
+	}
+	cfg.hdr_exposure = ts_lookup_num(ts, CFGNAME_HDR_EXPOSURE, 1.0f);
+
+	read_screen_cfg(ts);
+
 	cfg.ts = ts;
 }
 
+static void read_screen_cfg(struct ts_node *root)
+{
+	static float zero_vec[4];
+	struct ts_node *node;
+	struct cfg_screen *scr;
+	const char *str;
+
+	node = root->child_list;
+	while(node) {
+		if(strcmp(node->name, CFGNAME_SCREEN) == 0) {
+			cfg.num_scr++;
+		}
+		node = node->next;
+	}
+	if(!cfg.num_scr || !(cfg.scr = calloc(cfg.num_scr, sizeof *cfg.scr))) {
+		cfg.num_scr = 0;
+		return;
+	}
+
+	scr = cfg.scr;
+	node = root->child_list;
+	while(node) {
+		if(strcmp(node->name, CFGNAME_SCREEN) == 0) {
+			if(!(str = ts_get_attr_str(node, "name", 0))) {
+				fprintf(stderr, "ignoring screen block without a name attribute\n");
+				cfg.num_scr--;
+				node = node->next;
+				continue;
+			}
+			scr->name = strdup(str);
+
+			if((str = ts_get_attr_str(node, "image", 0))) {
+				scr->image = strdup(str);
+			}
+			if((str = ts_get_attr_str(node, "anim_mask", 0))) {
+				scr->anm_mask = strdup(str);
+			}
+			scr->fit = (str = ts_get_attr_str(node, "fit", 0)) ? cfg_parse_fit(str) : -1;
+			scr->zoom = ts_get_attr_num(node, "crop_zoom", -1.0f);
+			if(ts_get_attr(node, "crop_dir")) {
+				float *vec = ts_get_attr_vec(node, "crop_dir", zero_vec);
+				scr->crop_dir[0] = vec[0];
+				scr->crop_dir[1] = vec[1];
+				scr->have_crop_dir = 1;
+			}
+			scr++;
+		}
+		node = node->next;
+	}
+}
+
+struct cfg_screen *cfg_screen(int idx)
+{
+	int i;
+	char buf[16];
+	const char *name = screen[idx].name;
+
+	sprintf(buf, "%d", idx);
+	for(i=0; i<cfg.num_scr; i++) {
+		if((name && strcmp(cfg.scr[i].name, name) == 0) || strcmp(cfg.scr[i].name, buf) == 0) {
+			return cfg.scr + i;
+		}
+	}
+	return 0;
+}
+
+const char *cfg_screen_image(int idx)
+{
+	struct cfg_screen *scr = cfg_screen(idx);
+	return scr && scr->image ? scr->image : cfg.image;
+}
+
+const char *cfg_screen_anim_mask(int idx)
+{
+	struct cfg_screen *scr = cfg_screen(idx);
+	return scr && scr->anm_mask ? scr->anm_mask : cfg.anm_mask;
+}
+
 int save_cfg(const char *fname)
 {
 	return ts_save(cfg.ts, fname ? fname : get_save_config_path());
@@ -112,3 +223,19 @@ int cfg_parse_bgmode(const char *str)
 	fprintf(stderr, "invalid value to option \"" CFGNAME_BGMODE "\": %s\n", str);
 	return XLIVEBG_BG_SOLID;
 }
+
+int cfg_parse_tonemap(const char *str)
+{
+	if(strcasecmp(str, "clamp") == 0) {
+		return IMG_TONEMAP_CLAMP;
+	}
+	if(strcasecmp(str, "reinhard") == 0) {
+		return IMG_TONEMAP_REINHARD;
+	}
+	if(strcasecmp(str, "aces") == 0) {
+		return IMG_TONEMAP_ACES;
+	}
+
+	fprintf(stderr, "invalid value to option \"" CFGNAME_HDR_TONEMAP "\": %s\n", str);
+	return IMG_TONEMAP_CLAMP;
+}
@@ -21,6 +21,16 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "util.h"
 #include "treestore.h"
 
+/* per-output overrides, from screen blocks in the config file */
+struct cfg_screen {
+	char *name;				/* output name, or index */
+	char *image, *anm_mask;	/* null to use the global setting */
+	int fit;				/* -1 to use the global setting */
+	float zoom;				/* negative to use the global setting */
+	float crop_dir[2];
+	int have_crop_dir;
+};
+
 struct cfg {
 	char *act_plugin;
 	char *image, *anm_mask;
@@ -31,6 +41,19 @@ struct cfg {
 	int fit;
 	float zoom;
 	float crop_dir[2];
+	int cache_ram, cache_vram;	/* image cache budget in megabytes */
+	int disk_cache, disk_cache_size;	/* enable persistent cache, and its size in megabytes */
+	char *shared_cache;			/* cache directory shared by all instances, or null */
+	char *shared_cache_owner;	/* user whose shared cache entries are trusted */
+	int slideshow_interval;		/* seconds between slides, when the image is a directory */
+	float xfade_time;			/* crossfade duration in seconds when the image changes */
+	int compact_tex;			/* use 16bit textures for opaque backgrounds */
+	int preview;				/* show a quick low resolution decode of new images first */
+	int hdr_tonemap;			/* tone mapping operator for HDR images (IMG_TONEMAP_*) */
+	float hdr_exposure;			/* HDR images are scaled by this before tone mapping */
+
+	struct cfg_screen *scr;
+	int num_scr;
 
 	struct ts_node *ts;
 };
@@ -48,11 +71,38 @@ extern char *cfgpath;
 #define CFGNAME_FIT			"xlivebg.fit"
 #define CFGNAME_CROP_ZOOM	"xlivebg.crop_zoom"
 #define CFGNAME_CROP_DIR	"xlivebg.crop_dir"
+#define CFGNAME_CACHE_RAM	"xlivebg.cache_ram"
+#define CFGNAME_CACHE_VRAM	"xlivebg.cache_vram"
+#define CFGNAME_DISK_CACHE	"xlivebg.disk_cache"
+#define CFGNAME_DISK_CACHE_SIZE	"xlivebg.disk_cache_size"
+#define CFGNAME_SHARED_CACHE	"xlivebg.shared_cache"
+#define CFGNAME_SHARED_CACHE_OWNER	"xlivebg.shared_cache_owner"
+#define CFGNAME_SLIDESHOW_INTERVAL	"xlivebg.slideshow_interval"
+#define CFGNAME_XFADE_TIME	"xlivebg.crossfade"
+#define CFGNAME_COMPACT_TEX	"xlivebg.compact_textures"
+#define CFGNAME_PREVIEW		"xlivebg.preview"
+#define CFGNAME_HDR_TONEMAP	"xlivebg.hdr_tonemap"
+#define CFGNAME_HDR_EXPOSURE	"xlivebg.hdr_exposure"
+#define CFGNAME_SCREEN		"screen"
+
+#define DEF_CACHE_RAM		128
+#define DEF_CACHE_VRAM		256
+#define DEF_DISK_CACHE_SIZE	1024
+#define DEF_SLIDESHOW_INTERVAL	300
+#define DEF_XFADE_TIME		1.0f
 
 void init_cfg(void);
 int save_cfg(const char *fname);
 
+/* returns the overrides for the specified output, or null if there are none */
+struct cfg_screen *cfg_screen(int idx);
+
+/* per-output settings, falling back to the global ones */
+const char *cfg_screen_image(int idx);
+const char *cfg_screen_anim_mask(int idx);
+
 int cfg_parse_fit(const char *str);
 int cfg_parse_bgmode(const char *str);
+int cfg_parse_tonemap(const char *str);
 
 #endif	/* CFG_H_ */
@@ -26,6 +26,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include "imago2.h"
 #include "ctrl.h"
 
 static int cmd_generic(int argc, char **argv);
@@ -34,6 +35,7 @@ static int cmd_list(int argc, char **argv);
 static int cmd_lsprop(int argc, char **argv);
 static int cmd_setprop(int argc, char **argv);
 static int cmd_getprop(int argc, char **argv);
+static int cmd_convert(int argc, char **argv);
 
 static int read_line(int fd, char *line, int maxsz);
 
@@ -43,6 +45,7 @@ static void print_usage(void);
 static struct {
 	const char *name;
 	int (*func)(int, char**);
+	int local;	/* runs on its own, without connecting to xlivebg */
 } commands[] = {
 	{"ping", cmd_generic},
 	{"save", cmd_generic},
@@ -52,6 +55,7 @@ static struct {
 	{"lsprop", cmd_lsprop},
 	{"setprop", cmd_setprop},
 	{"getprop", cmd_getprop},
+	{"convert", cmd_convert, 1},
 	{0, 0}
 };
 
@@ -72,6 +76,9 @@ int client_main(int argc, char **argv)
 	if(parse_args(argc, argv) == -1) {
 		return 1;
 	}
+	if(commands[cmd].local) {
+		return commands[cmd].func(argc, argv) == -1 ? 1 : 0;
+	}
 
 	if((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
 		perror("failed to create UNIX domain socket");
@@ -324,6 +331,63 @@ err:
 	return -1;
 }
 
+/* Converts an image to a mipmap container, which can be uploaded as a texture
+ * directly, without decoding it or generating mipmaps. The image can be
+ * resized first, to the size it's going to be displayed at.
+ */
+static int cmd_convert(int argc, char **argv)
+{
+	int i, width = 0, height = 0;
+	unsigned int flags = 0;
+	char *infile = 0, *outfile = 0;
+	struct img_pixmap img;
+	struct img_load_opt opt;
+
+	for(i=2; i<argc; i++) {
+		if(strcmp(argv[i], "-lz4") == 0) {
+			flags |= IMG_MIPMAP_LZ4;
+		} else if(strcmp(argv[i], "-size") == 0) {
+			if(!argv[++i] || sscanf(argv[i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+				fprintf(stderr, "-size must be followed by <width>x<height>\n");
+				return -1;
+			}
+		} else if(!infile) {
+			infile = argv[i];
+		} else if(!outfile) {
+			outfile = argv[i];
+		} else {
+			fprintf(stderr, "unexpected argument: %s\n", argv[i]);
+			return -1;
+		}
+	}
+	if(!outfile) {
+		fprintf(stderr, "convert needs an input and an output file\n");
+		return -1;
+	}
+
+	img_load_opt_init(&opt);
+	opt.fmt = IMG_FMT_RGBA32;
+
+	img_init(&img);
+	if(img_load_ex(&img, infile, &opt) == -1) {
+		fprintf(stderr, "failed to load image: %s\n", infile);
+		img_destroy(&img);
+		return -1;
+	}
+	if(width && img_resize(&img, width, height) == -1) {
+		fprintf(stderr, "failed to resize image to %dx%d\n", width, height);
+		img_destroy(&img);
+		return -1;
+	}
+	if(img_save_mipmap(&img, outfile, flags) == -1) {
+		fprintf(stderr, "failed to write mipmap container: %s\n", outfile);
+		img_destroy(&img);
+		return -1;
+	}
+	img_destroy(&img);
+	return 0;
+}
+
 static char inbuf[1024];
 static char *inbuf_head = inbuf;
 static char *inbuf_tail = inbuf;
@@ -390,5 +454,7 @@ static void print_usage(void)
 	printf("  lsprop [name]: list properties of named or current live wallpaper\n");
 	printf("  setprop <type> <property> <value>: sets a property\n");
 	printf("  getprop <type>: prints the current value of a property\n");
+	printf("  convert [-lz4] [-size <w>x<h>] <image> <output>: convert an image to a\n");
+	printf("      mipmap container (.imip), which loads without decoding\n");
 	printf("  help: print usage and exit\n");
 }
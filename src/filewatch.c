@@ -0,0 +1,170 @@
+/*
+xlivebg - live wallpapers for the X window system
+Copyright (C) 2019-2020  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "filewatch.h"
+
+#ifdef __linux__
+#include <alloca.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include "imageman.h"
+
+/* Directories are watched instead of the files themselves, to also catch
+ * files being replaced by renaming a new file over them, which is how most
+ * programs save files safely.
+ */
+#define WATCH_MASK	(IN_CLOSE_WRITE | IN_MOVED_TO)
+
+struct watch {
+	int wd;
+	char *path, *fname;		/* full path as requested, and its filename part */
+	struct watch *next;
+};
+
+static int ifd = -1;
+static struct watch *wlist;
+
+
+int fwatch_init(void)
+{
+	if((ifd = inotify_init()) == -1) {
+		fprintf(stderr, "fwatch_init: failed to initialize inotify: %s\n", strerror(errno));
+		return -1;
+	}
+	fcntl(ifd, F_SETFL, fcntl(ifd, F_GETFL) | O_NONBLOCK);
+	return 0;
+}
+
+void fwatch_shutdown(void)
+{
+	struct watch *w;
+
+	while(wlist) {
+		w = wlist;
+		wlist = wlist->next;
+		free(w->path);
+		free(w);
+	}
+	if(ifd >= 0) {
+		close(ifd);
+		ifd = -1;
+	}
+}
+
+int fwatch_fd(void)
+{
+	return ifd;
+}
+
+int fwatch_add(const char *path)
+{
+	struct watch *w;
+	char *dir, *slash;
+
+	if(ifd == -1) return -1;
+
+	w = wlist;
+	while(w) {
+		if(strcmp(w->path, path) == 0) {
+			return 0;	/* already watched */
+		}
+		w = w->next;
+	}
+
+	if(!(w = malloc(sizeof *w)) || !(w->path = strdup(path))) {
+		free(w);
+		return -1;
+	}
+	dir = alloca(strlen(path) + 2);
+	strcpy(dir, path);
+	if((slash = strrchr(dir, '/'))) {
+		slash[slash == dir ? 1 : 0] = 0;
+		w->fname = w->path + (slash - dir) + 1;
+	} else {
+		strcpy(dir, ".");
+		w->fname = w->path;
+	}
+
+	if((w->wd = inotify_add_watch(ifd, dir, WATCH_MASK)) == -1) {
+		fprintf(stderr, "fwatch_add: failed to watch %s: %s\n", dir, strerror(errno));
+		free(w->path);
+		free(w);
+		return -1;
+	}
+	w->next = wlist;
+	wlist = w;
+	return 0;
+}
+
+void fwatch_process(void)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct inotify_event *ev;
+	struct watch *w;
+	char *ptr;
+	ssize_t rd;
+
+	while((rd = read(ifd, buf, sizeof buf)) > 0) {
+		ptr = buf;
+		while(ptr < buf + rd) {
+			ev = (struct inotify_event*)ptr;
+			ptr += sizeof *ev + ev->len;
+
+			if(!ev->len) continue;
+
+			w = wlist;
+			while(w) {
+				if(w->wd == ev->wd && strcmp(w->fname, ev->name) == 0) {
+					reload_image_file(w->path);
+				}
+				w = w->next;
+			}
+		}
+	}
+}
+
+#else	/* !__linux__ */
+
+int fwatch_init(void)
+{
+	return -1;
+}
+
+void fwatch_shutdown(void)
+{
+}
+
+int fwatch_fd(void)
+{
+	return -1;
+}
+
+int fwatch_add(const char *path)
+{
+	return -1;
+}
+
+void fwatch_process(void)
+{
+}
+
+#endif	/* __linux__ */
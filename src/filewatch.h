@@ -0,0 +1,35 @@
+/*
+xlivebg - live wallpapers for the X window system
+Copyright (C) 2019-2020  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef FILEWATCH_H_
+#define FILEWATCH_H_
+
+/* Watches image files for modifications (inotify, linux only). Changed files
+ * are passed to reload_image_file by fwatch_process.
+ */
+
+int fwatch_init(void);
+void fwatch_shutdown(void);
+
+/* returns the inotify file descriptor, or -1 if file watching is unavailable */
+int fwatch_fd(void);
+
+int fwatch_add(const char *path);
+
+void fwatch_process(void);
+
+#endif	/* FILEWATCH_H_ */
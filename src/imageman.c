@@ -18,60 +18,246 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <GL/gl.h>
+#include <limits.h>
+#include <math.h>
+#include <sys/stat.h>
 #include <imago2.h>
+#include "opengl.h"
 #include "imageman.h"
+#include "imgcache.h"
+#include "loader.h"
+#include "filewatch.h"
+#include "slideshow.h"
+#include "plugin.h"
+#include "app.h"
 #include "cfg.h"
 
+/* Mipmap levels of an image file which is a mipmap container, below the level
+ * which was loaded as the image. They're read along with the image, and kept
+ * with its pixels, to be uploaded with its texture.
+ */
+struct mip_chain {
+	int width, height;			/* size of the image they belong to */
+	int num_levels;				/* down to 1x1, halving each dimension above 1 */
+	uint32_t *pixels;			/* all levels, one after the other */
+};
+
+/* cache bookkeeping for each image known to the image manager */
+struct image_entry {
+	struct xlivebg_image *img;
+	int nref;					/* number of active uses (bg/mask selections) */
+	unsigned long last_use;		/* LRU timestamp, updated when nref drops to 0 */
+	int scr;					/* output the image was resampled for, -1 for all */
+	int src_width, src_height;	/* size of the image file, 0 if unknown */
+
+	int reloading;				/* 1: reload in progress, 2: file changed again since */
+	uint32_t *new_pixels;		/* reloaded pixels, waiting to replace the texture */
+	int new_width, new_height;
+	struct mip_chain *mips;		/* mipmaps of the pixels from a mipmap container */
+	struct mip_chain *new_mips;	/* mipmaps of new_pixels */
+	int prefetch;				/* loaded ahead of time, kept until it's first used */
+	int preview;				/* reduced decode, until the full image is loaded */
+	int cpu_access;				/* keep pixels in memory after uploading the texture */
+	int mask;					/* used as an animation mask */
+	int opaque;					/* all pixels have alpha 255 (-1: not checked yet) */
+	int tex_bpp;				/* bytes per pixel of the texture internal format */
+
+	dev_t dev;					/* identity of the image file, 0 if not a file */
+	ino_t ino;
+	int hnext;					/* next entry in the same hash bucket, or -1 */
+	int pnext;					/* next entry in the same image pointer bucket */
+};
+
+/* Entries of images loaded from files are indexed by the device and inode of
+ * the file, so the same file reached through different paths is found too.
+ * Paths are also canonicalized with realpath before loading.
+ */
+#define MIN_HASH_SIZE	64
+
+/* All entries are also indexed by their image pointer, for find_entry, which
+ * runs multiple times per frame. Entries are never removed, so the table only
+ * grows, keeping at most one entry per bucket on average.
+ */
+#define HASH_PTR(p) \
+	((unsigned int)((uint64_t)(uintptr_t)(p) * 0x9e3779b97f4a7c15 >> 32))
+
+/* mask of the outputs covered by an output index, where -1 means all of them */
+#define SCRMASK(scr)	((scr) < 0 ? ~0u : ((scr) < MAX_SCR ? 1u << (scr) : 0))
+
+/* output parameters which determine the size images are resampled to */
+struct scr_geom {
+	int width, height, fit;
+	float zoom;
+};
+
+/* Images are decoded at the smallest size needed by the outputs in scrmask,
+ * which lets the decoder skip work (see decode_size). The output parameters
+ * are copied when the request is made, because decoding may take place in the
+ * loader thread.
+ */
+struct size_req {
+	struct scr_geom geom[MAX_SCR];
+	int num_geom;
+	unsigned int scrmask;
+	int src_width, src_height;	/* size of the image file, set while decoding */
+};
+
+/* job data for decoding an image file in the background, either to reload a
+ * modified file, or to prefetch the next slide of a slideshow
+ */
+struct load_job {
+	char *path;
+	struct img_pixmap pixmap;	/* decoded image, large enough for every target */
+	struct mip_chain *mips;		/* mipmaps of the decoded image, if any */
+	struct load_target {
+		struct xlivebg_image *img;	/* image to reload, null when prefetching */
+		int scr;
+		struct img_pixmap pixmap;	/* resampled for this image or output */
+	} *targets;
+	int num_targets;
+
+	struct size_req req;		/* req.scrmask: outputs to decode for */
+	void (*done)(int, void*);
+	void *cls;
+};
+
+/* blended image shown on an output while crossfading between two images */
+struct crossfade {
+	struct xlivebg_image *from, *to;
+	struct xlivebg_image img;
+	unsigned int fbo;
+	unsigned long start;
+};
+
+/* texture uploads are streamed over multiple frames, in chunks of at most
+ * this many bytes per frame
+ */
+#define UPLOAD_CHUNK_SIZE	(4 << 20)
+
+/* state of the texture upload in progress */
+struct upload_state {
+	struct xlivebg_image *img;
+	uint32_t *pixels;			/* source pixels, either img->pixels or reloaded ones */
+	int width, height;
+	struct mip_chain *mips;		/* their mipmaps, owned by the upload if replacing */
+	int replace;				/* replacing an existing texture with reloaded pixels */
+	unsigned int tex, pbo;
+	unsigned int tex_fmt;		/* internal format of the texture */
+	int next_row;
+};
+
 static int gen_test_image(struct xlivebg_image *img, int width, int height);
+static struct image_entry *find_entry(struct xlivebg_image *img);
+static void ref_image(struct xlivebg_image *img);
+static void unref_image(struct xlivebg_image *img);
+static int restore_image(struct xlivebg_image *img);
+static int restore_pixels(struct xlivebg_image *img);
+static void release_pixels(struct xlivebg_image *img);
+static unsigned int tex_format(struct xlivebg_image *img, uint32_t *pixels);
+static void free_pixels(struct xlivebg_image *img);
+static int load_image_file(struct xlivebg_image *img, const char *fname, int scr,
+		struct img_pixmap *decoded, int *src_width, int *src_height, int *preview);
+static int load_preview(struct xlivebg_image *img, const char *fname, int scr,
+		int *src_width, int *src_height);
+static struct xlivebg_image *screen_image(const char *fname, int scr, struct img_pixmap *decoded);
+static const char *canon_path(const char *fname, char *buf);
+static int file_entry(const char *fname, dev_t *dev, ino_t *ino);
+static int next_file_entry(int idx, dev_t dev, ino_t ino);
+static void hash_insert(int idx);
+static void hash_remove(int idx);
+static int grow_ptab(int size);
+static int src_image_size(const char *fname, int *width, int *height);
+static struct image_entry *find_screen_image(const char *fname, int scr, int src_width, int src_height);
+static struct image_entry *add_screen_image(struct xlivebg_image *img, const char *fname,
+		int scr, int src_width, int src_height);
+static int prefetch_cached(const char *fname, int scr);
+static void assign_images(const char *(*getname)(int), void (*setimg)(int, struct xlivebg_image*));
+static float calc_image_scale(int width, int height, int scr);
+static void calc_image_size(int width, int height, int scr, int *res_width, int *res_height);
+static void get_scr_geom(struct scr_geom *geom);
+static float geom_image_scale(const struct scr_geom *geom, int num, unsigned int scrmask,
+		int width, int height);
+static void geom_image_size(const struct scr_geom *geom, int num, unsigned int scrmask,
+		int width, int height, int *res_width, int *res_height);
+static void init_size_req(struct size_req *req, unsigned int scrmask);
+static void decode_size(int width, int height, int *res_width, int *res_height, void *cls);
+static void preview_size(int width, int height, int *res_width, int *res_height, void *cls);
+static void init_load_opt(struct img_load_opt *opt);
+static unsigned int cache_variant(int scr);
+static struct xlivebg_image *shown_image(struct xlivebg_image *img, struct xlivebg_image **shown);
+static int begin_upload(struct xlivebg_image *img, uint32_t *pixels, int width, int height);
+static int upload_chunk(long maxbytes);
+static void cancel_upload(void);
+static int upload_mipmaps(struct mip_chain *mips, int width, int height, unsigned int tex_fmt);
+static struct mip_chain *load_mip_chain(const char *fname, int width, int height);
+static void install_pixels(struct xlivebg_image *img, uint32_t *pixels, int width, int height,
+		struct mip_chain *mips);
+static struct load_job *alloc_load_job(const char *path);
+static void free_load_job(struct load_job *job);
+static struct load_target *add_target(struct load_job *job, int width, int height);
+static struct mip_chain *take_mips(struct load_job *job, struct load_target *tg);
+static void load_decode(void *data);
+static void load_resample(void *data);
+static void start_reload(const char *path, int previews);
+static void refine_previews(void);
+static void reload_decode_done(void *data);
+static void reload_resample_done(void *data);
+static void prefetch_decode_done(void *data);
+static void prefetch_resample_done(void *data);
+static struct xlivebg_image *bg_image(int scr);
+static void begin_crossfade(int scr, struct xlivebg_image *from, struct xlivebg_image *to);
+static void end_crossfade(int scr);
+static void draw_crossfade(int scr, float t);
 
-static struct xlivebg_image **images;
+static struct image_entry *images;
 static int num_images, max_images;
+static int *htab, htab_size, num_hashed;
+static int *ptab, ptab_size;
+static unsigned long lru_clock;
+
+static struct xlivebg_image *bg[MAX_SCR], *bgmask[MAX_SCR];
+static struct xlivebg_image *testimg;
+/* images currently displayed, which may lag behind bg/bgmask during uploads */
+static struct xlivebg_image *bg_shown[MAX_SCR], *bgmask_shown[MAX_SCR];
 
-static struct xlivebg_image *bg, *bgmask;
+static struct upload_state upload;
+static struct crossfade xfade[MAX_SCR];
 
 
 void init_imgman(void)
 {
-	struct xlivebg_image *img;
+	imgcache_init();
+	update_screen_images();
+}
 
-	if((img = malloc(sizeof *img))) {
-		if(gen_test_image(img, 1920, 1080) == -1) {
-			free(img);
-		} else {
-			add_image(img);
-		}
-	}
+/* assigns background images and animation masks to all outputs, according to
+ * the current configuration
+ */
+void update_screen_images(void)
+{
+	int i;
 
-	if(cfg.image) {
-		if((img = malloc(sizeof *img))) {
-			if(load_image(img, cfg.image) == -1) {
-				free(img);
-			} else {
-				add_image(img);
-				bg = img;
-			}
-		}
-	}
-	if(cfg.anm_mask) {
-		if((img = malloc(sizeof *img))) {
-			if(load_image(img, cfg.anm_mask) == -1) {
-				free(img);
-			} else {
-				add_image(img);
-				bgmask = img;
-			}
-		}
+	assign_images(cfg_screen_image, set_bg_image);
+	assign_images(cfg_screen_anim_mask, set_anim_mask);
+
+	for(i=num_screens; i<MAX_SCR; i++) {
+		set_bg_image(i, 0);
+		set_anim_mask(i, 0);
 	}
 }
 
 void destroy_all_textures(void)
 {
 	int i;
+
+	cancel_upload();
+	for(i=0; i<MAX_SCR; i++) {
+		end_crossfade(i);
+	}
 	for(i=0; i<num_images; i++) {
-		if(images[i]->tex) {
-			glDeleteTextures(1, &images[i]->tex);
-			images[i]->tex = 0;
+		if(images[i].img->tex) {
+			glDeleteTextures(1, &images[i].img->tex);
+			images[i].img->tex = 0;
 		}
 	}
 }
@@ -97,74 +283,40 @@ int create_image(struct xlivebg_image *img, int width, int height, uint32_t *pix
 void destroy_image(struct xlivebg_image *img)
 {
 	if(img) {
-		free(img->pixels);
-		img->pixels = 0;
+		free_pixels(img);
 	}
 }
 
 int load_image(struct xlivebg_image *img, const char *fname)
 {
+	int src_width, src_height;
+	char pathbuf[PATH_MAX];
+
+	fname = canon_path(fname, pathbuf);
 	memset(img, 0, sizeof *img);
-	if(!(img->pixels = img_load_pixels(fname, &img->width, &img->height, IMG_FMT_RGBA32))) {
+	if(load_image_file(img, fname, -1, 0, &src_width, &src_height, 0) == -1) {
 		fprintf(stderr, "xlivebg: failed to load image: %s\n", fname);
 		return -1;
 	}
 	if((img->path = malloc(strlen(fname) + 1))) {
 		strcpy(img->path, fname);
 	}
+	fwatch_add(fname);
 	return 0;
 }
 
-struct memdata {
-	char *data;
-	long size, curpos;
-};
-
-static size_t memread(void *buf, size_t bytes, void *uptr)
-{
-	struct memdata *mem = uptr;
-	long left = mem->size - mem->curpos;
-
-	if(left <= 0) return 0;
-	if((long)bytes > left) bytes = left;
-	memcpy(buf, mem->data + mem->curpos, bytes);
-	mem->curpos += bytes;
-	return bytes;
-}
-
-static long memseek(long offs, int whence, void *uptr)
-{
-	struct memdata *mem = uptr;
-
-	switch(whence) {
-	case SEEK_SET:
-		mem->curpos = offs;
-		break;
-	case SEEK_CUR:
-		mem->curpos += offs;
-		break;
-	case SEEK_END:
-		mem->curpos = mem->size + offs;
-		break;
-	}
-	if(mem->curpos < 0) mem->curpos = 0;
-	if(mem->curpos > mem->size) mem->curpos = mem->size;
-	return mem->curpos;
-}
-
 int load_image_mem(struct xlivebg_image *img, void *data, long datasz)
 {
 	struct img_pixmap pixmap;
-	struct memdata memdata;
-	struct img_io io = {0, memread, 0, memseek};
+	struct img_load_opt opt;
+	struct img_io io;
 
-	memdata.data = data;
-	memdata.size = datasz;
-	memdata.curpos = 0;
-	io.uptr = &memdata;
+	/* decoders read straight from the buffer */
+	img_io_set_mem(&io, data, datasz);
+	init_load_opt(&opt);
 
 	img_init(&pixmap);
-	if(img_read(&pixmap, &io) == -1 || img_convert(&pixmap, IMG_FMT_RGBA32) == -1) {
+	if(img_read_ex(&pixmap, &io, &opt) == -1) {
 		img_destroy(&pixmap);
 		fprintf(stderr, "xlivebg: failed to read image from memory\n");
 		return -1;
@@ -179,9 +331,16 @@ int load_image_mem(struct xlivebg_image *img, void *data, long datasz)
 
 int add_image(struct xlivebg_image *img)
 {
+	struct image_entry *ent;
+	int bucket;
+
+	if(num_images >= ptab_size && grow_ptab(ptab_size ? ptab_size * 2 : MIN_HASH_SIZE) == -1) {
+		perror("add_image");
+		return -1;
+	}
 	if(num_images >= max_images) {
 		int nmax = max_images ? max_images * 2 : 16;
-		struct xlivebg_image **tmp = realloc(images, nmax * sizeof *images);
+		struct image_entry *tmp = realloc(images, nmax * sizeof *images);
 		if(!tmp) {
 			perror("add_image");
 			return -1;
@@ -189,7 +348,31 @@ int add_image(struct xlivebg_image *img)
 		images = tmp;
 		max_images = nmax;
 	}
-	images[num_images++] = img;
+	ent = images + num_images++;
+	ent->img = img;
+	ent->nref = 0;
+	ent->last_use = ++lru_clock;
+	ent->scr = -1;
+	ent->src_width = ent->src_height = 0;
+	ent->reloading = 0;
+	ent->new_pixels = 0;
+	ent->mips = ent->new_mips = 0;
+	ent->prefetch = 0;
+	ent->cpu_access = 0;
+	ent->mask = 0;
+	ent->opaque = -1;
+	ent->tex_bpp = 4;
+
+	ent->dev = 0;
+	ent->ino = 0;
+	ent->hnext = -1;
+	if(img->path) {
+		hash_insert(num_images - 1);
+	}
+
+	bucket = HASH_PTR(img) & (ptab_size - 1);
+	ent->pnext = ptab[bucket];
+	ptab[bucket] = num_images - 1;
 	return 0;
 }
 
@@ -201,7 +384,11 @@ struct xlivebg_image *get_image(int idx)
 		return 0;
 	}
 
-	img = images[idx];
+	img = images[idx].img;
+	images[idx].last_use = ++lru_clock;
+	if(restore_image(img) == -1) {
+		return 0;
+	}
 	update_texture(img);
 	return img;
 }
@@ -213,17 +400,199 @@ int get_image_count(void)
 
 int find_image(const char *name)
 {
-	int i;
-	for(i=0; i<num_images; i++) {
-		if(images[i]->path && strcmp(name, images[i]->path) == 0) {
-			return i;
+	dev_t dev;
+	ino_t ino;
+
+	return file_entry(name, &dev, &ino);
+}
+
+/* returns the canonical absolute path of fname in buf, or fname itself if it
+ * can't be resolved
+ */
+static const char *canon_path(const char *fname, char *buf)
+{
+	return realpath(fname, buf) ? buf : fname;
+}
+
+#define HASH_FILE(dev, ino) \
+	((unsigned int)(((uint64_t)(dev) * 0x9e3779b97f4a7c15 ^ (uint64_t)(ino)) * 0x9e3779b97f4a7c15 >> 32))
+
+/* returns the index of the first entry loaded from the file fname, or -1 if
+ * there are none. The rest are found by passing the returned dev/ino to
+ * next_file_entry.
+ */
+static int file_entry(const char *fname, dev_t *dev, ino_t *ino)
+{
+	struct stat st;
+
+	if(!htab || stat(fname, &st) == -1) {
+		return -1;
+	}
+	*dev = st.st_dev;
+	*ino = st.st_ino;
+	return next_file_entry(htab[HASH_FILE(st.st_dev, st.st_ino) & (htab_size - 1)], st.st_dev, st.st_ino);
+}
+
+/* returns idx, or the next entry after it in the same chain, with matching dev/ino */
+static int next_file_entry(int idx, dev_t dev, ino_t ino)
+{
+	while(idx >= 0) {
+		if(images[idx].ino == ino && images[idx].dev == dev) {
+			return idx;
 		}
+		idx = images[idx].hnext;
 	}
 	return -1;
 }
 
+static void hash_insert(int idx)
+{
+	int i, *tmp, bucket, nsize;
+	struct image_entry *ent = images + idx;
+	struct stat st;
+
+	if(stat(ent->img->path, &st) == -1) {
+		return;
+	}
+	ent->dev = st.st_dev;
+	ent->ino = st.st_ino;
+
+	if(num_hashed >= htab_size) {
+		nsize = htab_size ? htab_size * 2 : MIN_HASH_SIZE;
+		if(!(tmp = malloc(nsize * sizeof *htab))) {
+			ent->dev = ent->ino = 0;
+			return;
+		}
+		free(htab);
+		htab = tmp;
+		htab_size = nsize;
+
+		/* rehash all file entries */
+		for(i=0; i<htab_size; i++) {
+			htab[i] = -1;
+		}
+		for(i=0; i<num_images; i++) {
+			if(i != idx && images[i].ino) {
+				bucket = HASH_FILE(images[i].dev, images[i].ino) & (htab_size - 1);
+				images[i].hnext = htab[bucket];
+				htab[bucket] = i;
+			}
+		}
+	}
+
+	bucket = HASH_FILE(ent->dev, ent->ino) & (htab_size - 1);
+	ent->hnext = htab[bucket];
+	htab[bucket] = idx;
+	num_hashed++;
+}
+
+static void hash_remove(int idx)
+{
+	int *iptr;
+	struct image_entry *ent = images + idx;
+
+	if(!ent->ino) return;
+
+	iptr = htab + (HASH_FILE(ent->dev, ent->ino) & (htab_size - 1));
+	while(*iptr >= 0) {
+		if(*iptr == idx) {
+			*iptr = ent->hnext;
+			num_hashed--;
+			break;
+		}
+		iptr = &images[*iptr].hnext;
+	}
+	ent->dev = ent->ino = 0;
+	ent->hnext = -1;
+}
+
+/* resizes the image pointer table, and reinserts all entries */
+static int grow_ptab(int size)
+{
+	int i, bucket, *tmp;
+
+	if(!(tmp = malloc(size * sizeof *ptab))) {
+		return -1;
+	}
+	free(ptab);
+	ptab = tmp;
+	ptab_size = size;
+
+	for(i=0; i<ptab_size; i++) {
+		ptab[i] = -1;
+	}
+	for(i=0; i<num_images; i++) {
+		bucket = HASH_PTR(images[i].img) & (ptab_size - 1);
+		images[i].pnext = ptab[bucket];
+		ptab[bucket] = i;
+	}
+	return 0;
+}
+
+/* images which can't be reloaded from a file (no path) are never evicted */
+#define EVICTABLE(ent)	\
+	((ent)->nref <= 0 && (ent)->img->path && (ent)->img != upload.img && !(ent)->prefetch)
+
+#define IMG_RAM_SIZE(img)	((unsigned long)(img)->width * (img)->height * 4)
+/* mipmap chains take up approximately 1/3 of the image */
+#define ENT_RAM_SIZE(ent)	\
+	(IMG_RAM_SIZE((ent)->img) + ((ent)->mips ? IMG_RAM_SIZE((ent)->img) / 3 : 0))
+/* mipmapped textures take up approximately 4/3 of the base level */
+#define ENT_VRAM_SIZE(ent)	\
+	((unsigned long)(ent)->img->width * (ent)->img->height * (ent)->tex_bpp / 3 * 4)
+
+/* evicts least recently used, unreferenced, images until the total memory
+ * used by cached images falls within the configured budget. Evicted images
+ * keep their entry and path, and are reloaded on demand.
+ */
+void trim_image_cache(void)
+{
+	int i, lru;
+	unsigned long ram_used = 0, vram_used = 0;
+	unsigned long ram_max = (unsigned long)cfg.cache_ram << 20;
+	unsigned long vram_max = (unsigned long)cfg.cache_vram << 20;
+
+	for(i=0; i<num_images; i++) {
+		struct xlivebg_image *img = images[i].img;
+		if(img->pixels) ram_used += ENT_RAM_SIZE(images + i);
+		if(img->tex) vram_used += ENT_VRAM_SIZE(images + i);
+	}
+
+	while(ram_used > ram_max) {
+		lru = -1;
+		for(i=0; i<num_images; i++) {
+			if(images[i].img->pixels && EVICTABLE(images + i) &&
+					(lru == -1 || images[i].last_use < images[lru].last_use)) {
+				lru = i;
+			}
+		}
+		if(lru == -1) break;
+
+		ram_used -= ENT_RAM_SIZE(images + lru);
+		free_pixels(images[lru].img);
+	}
+
+	while(vram_used > vram_max) {
+		lru = -1;
+		for(i=0; i<num_images; i++) {
+			if(images[i].img->tex && EVICTABLE(images + i) &&
+					(lru == -1 || images[i].last_use < images[lru].last_use)) {
+				lru = i;
+			}
+		}
+		if(lru == -1) break;
+
+		glDeleteTextures(1, &images[lru].img->tex);
+		images[lru].img->tex = 0;
+		vram_used -= ENT_VRAM_SIZE(images + lru);
+	}
+}
+
 int dump_image(struct xlivebg_image *img, const char *fname)
 {
+	if(!img->pixels && img->tex) {
+		return dump_image_tex(img, fname);
+	}
 	return img_save_pixels(fname, img->pixels, img->width, img->height, IMG_FMT_RGBA32);
 }
 
@@ -247,63 +616,1721 @@ int dump_image_tex(struct xlivebg_image *img, const char *fname)
 
 struct xlivebg_image *get_bg_image(int scr)
 {
-	struct xlivebg_image *img = bg ? bg : images[0];
-	update_texture(img);
+	struct xlivebg_image *img;
+
+	if(scr < 0 || scr >= MAX_SCR) scr = 0;
+
+	img = shown_image(bg_image(scr), bg_shown + scr);
+	if(xfade[scr].from && xfade[scr].to == img) {
+		return &xfade[scr].img;
+	}
 	return img;
 }
 
 struct xlivebg_image *get_anim_mask(int scr)
 {
-	update_texture(bgmask);
-	return bgmask;
+	if(scr < 0 || scr >= MAX_SCR) scr = 0;
+	return shown_image(bgmask[scr], bgmask_shown + scr);
+}
+
+/* called once per frame, to advance any texture upload in progress */
+void update_image_uploads(void)
+{
+	int i;
+
+	if(!upload.img) {
+		/* replace textures of images which were reloaded */
+		for(i=0; i<num_images; i++) {
+			struct image_entry *ent = images + i;
+			if(ent->new_pixels) {
+				if(begin_upload(ent->img, ent->new_pixels, ent->new_width, ent->new_height) != -1) {
+					upload.replace = 1;
+					upload.mips = ent->new_mips;
+					ent->new_pixels = 0;
+					ent->new_mips = 0;
+				}
+				break;
+			}
+		}
+	}
+	if(!upload.img) {
+		/* upload prefetched images ahead of time */
+		for(i=0; i<num_images; i++) {
+			struct image_entry *ent = images + i;
+			if(ent->prefetch && ent->img->pixels && !ent->img->tex) {
+				begin_upload(ent->img, 0, 0, 0);
+				break;
+			}
+		}
+	}
+	if(upload.img) {
+		upload_chunk(UPLOAD_CHUNK_SIZE);
+	}
+}
+
+/* Called when an image file has been modified. All images loaded from it are
+ * decoded and resampled again in the background, and their textures replaced
+ * once the new pixels are uploaded.
+ */
+void reload_image_file(const char *path)
+{
+	int i, found = 0;
+
+	for(i=0; i<num_images; i++) {
+		struct image_entry *ent = images + i;
+		if(ent->img->path && strcmp(ent->img->path, path) == 0) {
+			if(ent->reloading) {
+				ent->reloading = 2;	/* reload again when the current one is done */
+				return;
+			}
+			found = 1;
+		}
+	}
+	if(!found) return;
+
+	printf("image file changed, reloading: %s\n", path);
+	start_reload(path, 0);
+}
+
+/* Called when the HDR tone mapping settings change. Images in use are decoded
+ * again in the background, like modified files. Since the format of a file is
+ * only known by decoding it, that includes every image. Unused images are
+ * dropped, to be reloaded on demand.
+ */
+void reload_images(void)
+{
+	int i;
+
+	/* reloads in progress may be using the old settings, repeat them */
+	for(i=0; i<num_images; i++) {
+		if(images[i].reloading) images[i].reloading = 2;
+	}
+
+	for(i=0; i<num_images; i++) {
+		struct image_entry *ent = images + i;
+		struct xlivebg_image *img = ent->img;
+
+		if(!img->path || ent->reloading) continue;
+
+		if(ent->nref > 0) {
+			start_reload(img->path, 0);
+			continue;
+		}
+		if(upload.img == img) {
+			cancel_upload();
+		}
+		free_pixels(img);
+		if(img->tex) {
+			glDeleteTextures(1, &img->tex);
+			img->tex = 0;
+		}
+	}
+}
+
+/* Decodes the file path again in the background, for all images loaded from it,
+ * or only for those which are previews if previews is non-zero.
+ */
+static void start_reload(const char *path, int previews)
+{
+	int i;
+	unsigned int scrmask = 0;
+	struct load_job *job;
+
+	if(!(job = alloc_load_job(path))) {
+		return;
+	}
+	for(i=0; i<num_images; i++) {
+		struct image_entry *ent = images + i;
+		if(ent->img->path && strcmp(ent->img->path, path) == 0 && (!previews || ent->preview)) {
+			ent->reloading = 1;
+			scrmask |= ent->scr < num_screens ? SCRMASK(ent->scr) : ~0u;
+		}
+	}
+	init_size_req(&job->req, scrmask);
+	loader_submit(load_decode, reload_decode_done, job);
+}
+
+/* starts loading the full images of previews shown by assign_images */
+static void refine_previews(void)
+{
+	int i;
+
+	for(i=0; i<num_images; i++) {
+		if(images[i].preview && !images[i].reloading) {
+			start_reload(images[i].img->path, 1);
+		}
+	}
+}
+
+int image_upload_pending(void)
+{
+	int i;
+
+	if(upload.img) return 1;
+	for(i=0; i<num_images; i++) {
+		if(images[i].new_pixels) return 1;
+	}
+	for(i=0; i<num_screens; i++) {
+		if(xfade[i].from) return 1;
+	}
+	return 0;
+}
+
+/* Called once per frame before drawing. Starts a crossfade on any output whose
+ * displayed background image changed since the last frame, and renders the
+ * blended image of crossfades in progress. Outputs which never had their
+ * background image requested by the active plugin are skipped.
+ */
+void update_crossfades(void)
+{
+	int i;
+	float t;
+	struct xlivebg_image *img, *prev;
+	long dur = (long)(cfg.xfade_time * 1000.0f);
+
+	for(i=0; i<num_screens; i++) {
+		if(!(prev = bg_shown[i])) continue;
+
+		ref_image(prev);	/* keep it alive, in case we fade from it */
+		img = shown_image(bg_image(i), bg_shown + i);
+
+		if(img != prev && dur > 0 && xlivebg_have_fbo && img && img->tex && prev->tex &&
+				img->path && prev->path && strcmp(img->path, prev->path) != 0) {
+			begin_crossfade(i, prev, img);
+		} else {
+			unref_image(prev);
+		}
+
+		if(xfade[i].from) {
+			if(xfade[i].to != img || (long)(msec - xfade[i].start) >= dur) {
+				end_crossfade(i);
+			} else {
+				t = (float)(msec - xfade[i].start) / (float)dur;
+				draw_crossfade(i, t);
+			}
+		}
+	}
 }
 
 
 void set_bg_image(int scr, struct xlivebg_image *img)
 {
-	bg = img;
+	struct xlivebg_image *prev = bg[scr];
+
+	if(img == prev) return;
+	if(img) {
+		restore_image(img);
+		ref_image(img);
+	}
+	bg[scr] = img;
+	if(prev) unref_image(prev);
 }
 
 void set_anim_mask(int scr, struct xlivebg_image *img)
 {
-	bgmask = img;
+	struct xlivebg_image *prev = bgmask[scr];
+
+	if(img == prev) return;
+	if(img) {
+		struct image_entry *ent = find_entry(img);
+		if(ent) ent->mask = 1;
+		restore_image(img);
+		ref_image(img);
+	}
+	bgmask[scr] = img;
+	if(prev) unref_image(prev);
 }
 
-static int gen_test_image(struct xlivebg_image *img, int width, int height)
+static struct image_entry *find_entry(struct xlivebg_image *img)
 {
-	int i, j;
-	uint32_t *pptr;
+	int idx;
 
-	if(create_image(img, width, height, 0) == -1) {
-		return -1;
+	if(!ptab) return 0;
+
+	idx = ptab[HASH_PTR(img) & (ptab_size - 1)];
+	while(idx >= 0) {
+		if(images[idx].img == img) {
+			return images + idx;
+		}
+		idx = images[idx].pnext;
 	}
-	pptr = img->pixels;
+	return 0;
+}
 
-	for(i=0; i<height; i++) {
-		for(j=0; j<width; j++) {
-			int xor = i ^ j;
+static void ref_image(struct xlivebg_image *img)
+{
+	struct image_entry *ent = find_entry(img);
+	if(ent) {
+		ent->nref++;
+		ent->prefetch = 0;
+	}
+}
 
-			uint32_t r = (xor << 1) & 0xff;
-			uint32_t g = xor & 0xff;
-			uint32_t b = (xor >> 1) & 0xff;
+static void unref_image(struct xlivebg_image *img)
+{
+	struct image_entry *ent = find_entry(img);
+	if(ent && --ent->nref <= 0) {
+		ent->nref = 0;
+		ent->last_use = ++lru_clock;
+		trim_image_cache();
+	}
+}
 
-			*pptr++ = (r << 16) | (g << 8) | b;
+/* Called when the outputs or the fit mode change. Images loaded at a different
+ * resolution than what's now required, are dropped and reloaded on demand.
+ * Images smaller than needed are reloaded too, since they may have been
+ * downscaled; if they weren't, the reload is served by the disk cache.
+ * Per-output images are reassigned, at the new resolution of each output.
+ */
+void update_image_sizes(void)
+{
+	int i, width, height;
+	float scale;
+
+	for(i=0; i<num_images; i++) {
+		struct xlivebg_image *img = images[i].img;
+
+		if(images[i].scr >= 0 || !img->path || (!img->pixels && !img->tex)) continue;
+
+		scale = calc_image_scale(img->width, img->height, -1);
+		width = (int)ceil(img->width * scale);
+		height = (int)ceil(img->height * scale);
+		if(abs(width - img->width) <= 1 && abs(height - img->height) <= 1) {
+			continue;
+		}
+
+		if(upload.img == img) {
+			cancel_upload();
+		}
+		free_pixels(img);
+		if(img->tex) {
+			glDeleteTextures(1, &img->tex);
+			img->tex = 0;
 		}
 	}
 
-	return 0;
+	update_screen_images();
 }
 
-void update_texture(struct xlivebg_image *img)
+/* reloads the pixels of an image previously evicted from the cache */
+static int restore_image(struct xlivebg_image *img)
 {
-	if(!img) return;
+	if(img->pixels || img->tex || !img->path) {
+		return 0;
+	}
+	return restore_pixels(img);
+}
+
+/* reloads the pixels of an image from the disk cache or its file, even if it
+ * has a texture
+ */
+static int restore_pixels(struct xlivebg_image *img)
+{
+	struct image_entry *ent;
+	int scr = -1, width, height, src_width, src_height;
+
+	if(img->pixels || !img->path) {
+		return 0;
+	}
+
+	if((ent = find_entry(img)) && ent->scr < num_screens) {
+		scr = ent->scr;
+	}
+	width = img->width;
+	height = img->height;
+	if(load_image_file(img, img->path, scr, 0, &src_width, &src_height, 0) == -1) {
+		fprintf(stderr, "xlivebg: failed to reload image: %s\n", img->path);
+		return -1;
+	}
+	if(ent) {
+		ent->preview = 0;
+		free(ent->mips);
+		ent->mips = load_mip_chain(img->path, img->width, img->height);
+	}
+	if(img->tex && (img->width != width || img->height != height)) {
+		/* the outputs changed since, the texture is out of date */
+		glDeleteTextures(1, &img->tex);
+		img->tex = 0;
+	}
+
+	trim_image_cache();
+	return 0;
+}
+
+/* Returns the pixels of an image, reloading them if they were dropped after
+ * uploading its texture. From then on, the pixels are kept in memory. Pixels
+ * mapped read-only from the shared cache are copied, since callers may write
+ * to them.
+ */
+uint32_t *get_image_pixels(struct xlivebg_image *img)
+{
+	struct image_entry *ent;
+	uint32_t *pixels;
+
+	if(!img) return 0;
+
+	if((ent = find_entry(img))) {
+		ent->cpu_access = 1;
+	}
+	if(!img->pixels && img->path) {
+		restore_pixels(img);
+	}
+	if(img->pixels && imgcache_isreadonly(img->pixels)) {
+		if(!(pixels = malloc(img->width * img->height * sizeof *pixels))) {
+			return 0;
+		}
+		memcpy(pixels, img->pixels, img->width * img->height * sizeof *pixels);
+		imgcache_unmap(img->pixels);
+		img->pixels = pixels;
+	}
+	return img->pixels;
+}
+
+/* Chooses the internal format of the texture of an image. Animation masks only
+ * need one channel, and opaque backgrounds can use 16bit RGB if compact
+ * textures are enabled. Pixels are always passed to OpenGL as RGBA, so
+ * there's no conversion on our side, and the CPU copy stays RGBA for plugins.
+ */
+static unsigned int tex_format(struct xlivebg_image *img, uint32_t *pixels)
+{
+	int i;
+	uint32_t *pptr;
+	struct image_entry *ent;
+
+	if(!(ent = find_entry(img))) {
+		return GL_RGBA;
+	}
+	ent->tex_bpp = 4;
+
+	if(ent->mask) {
+		/* unless the same image is also used as a background */
+		for(i=0; i<num_screens; i++) {
+			if(bg[i] == img) return GL_RGBA;
+		}
+		ent->tex_bpp = 1;
+		return GL_LUMINANCE8;
+	}
+
+	if(cfg.compact_tex && img->path) {
+		if(ent->opaque == -1 && (pptr = pixels)) {
+			ent->opaque = 1;
+			for(i=0; i<img->width * img->height; i++) {
+				if((*pptr++ & 0xff000000) != 0xff000000) {
+					ent->opaque = 0;
+					break;
+				}
+			}
+		}
+		if(ent->opaque == 1) {
+			ent->tex_bpp = 2;
+			return GL_RGB5;
+		}
+	}
+	return GL_RGBA;
+}
+
+/* Drops the pixels of an image file once its texture is uploaded, unless CPU
+ * access was requested. They're reloaded from the disk cache or the file if
+ * they're needed again. Images which weren't loaded from a file keep theirs:
+ * textures may be stored with fewer bits or channels (see tex_format), so
+ * reading them back would lose data.
+ */
+static void release_pixels(struct xlivebg_image *img)
+{
+	struct image_entry *ent = find_entry(img);
+
+	if(ent && !ent->cpu_access && img->tex && img->path) {
+		free_pixels(img);
+	}
+}
+
+/* Loads the pixels of an image file, either from the disk cache, or by decoding
+ * it, and downscales them to the size needed by output scr (or by any output if
+ * scr is -1). If the image had to be decoded and downscaled, and decoded is not
+ * null, the decoded image is returned there for reuse by other outputs, at the
+ * size needed by any of them.
+ * If preview is not null, and the image isn't in the disk cache, a quick
+ * reduced decode is tried first, and *preview is set if that's what's returned.
+ */
+static int load_image_file(struct xlivebg_image *img, const char *fname, int scr,
+		struct img_pixmap *decoded, int *src_width, int *src_height, int *preview)
+{
+	struct img_pixmap pixmap;
+	struct img_load_opt opt;
+	struct size_req req;
+	int width, height, res;
+
+	if(preview) *preview = 0;
+
+	if(imgcache_load(img, fname, cache_variant(scr), src_width, src_height) != -1) {
+		calc_image_size(*src_width, *src_height, scr, &width, &height);
+		if(img->width == width && img->height == height) {
+			return 0;
+		}
+		/* cached for a different output configuration */
+		imgcache_unmap(img->pixels);
+		img->pixels = 0;
+	}
+
+	if(preview && cfg.preview && (res = load_preview(img, fname, scr, src_width, src_height)) != -1) {
+		*preview = res;
+		return 0;
+	}
+
+	init_size_req(&req, SCRMASK(decoded ? -1 : scr));
+	init_load_opt(&opt);
+	opt.target_size = decode_size;
+	opt.cls = &req;
+
+	img_init(&pixmap);
+	if(img_load_ex(&pixmap, fname, &opt) == -1) {
+		img_destroy(&pixmap);
+		return -1;
+	}
+	*src_width = req.src_width;
+	*src_height = req.src_height;
+	free(pixmap.name);
+	pixmap.name = 0;
+
+	calc_image_size(*src_width, *src_height, scr, &width, &height);
+	if(width != pixmap.width || height != pixmap.height) {
+		if(decoded) {
+			struct img_pixmap full = pixmap;	/* large enough for any output */
+
+			img_init(&pixmap);
+			if(img_resample(&pixmap, &full, width, height) == -1) {
+				pixmap = full;
+			} else {
+				img_destroy(decoded);
+				*decoded = full;
+			}
+		} else {
+			img_resize(&pixmap, width, height);
+		}
+		if(pixmap.width != width) {
+			fprintf(stderr, "xlivebg: failed to resize image %s to %dx%d, keeping original size\n",
+					fname, width, height);
+		}
+	}
+
+	img->pixels = pixmap.pixels;
+	img->width = pixmap.width;
+	img->height = pixmap.height;
+
+	imgcache_store(img, fname, cache_variant(scr), *src_width, *src_height);
+	return 0;
+}
+
+/* Decodes an image file at 1/8 of its size (JPEG only), with the faster, less
+ * accurate settings of the decoder. Returns 1 if that's smaller than the size
+ * needed by output scr, and the image has to be loaded again later, 0 if it's
+ * the final image, or -1 if the format can't be decoded at a reduced size.
+ */
+static int load_preview(struct xlivebg_image *img, const char *fname, int scr,
+		int *src_width, int *src_height)
+{
+	struct img_pixmap pixmap;
+	struct img_load_opt opt;
+	struct size_req req;
+	int width, height;
+
+	init_size_req(&req, SCRMASK(scr));
+	init_load_opt(&opt);
+	opt.target_size = preview_size;
+	opt.cls = &req;
+	opt.preview = 1;
+
+	img_init(&pixmap);
+	if(img_load_ex(&pixmap, fname, &opt) == -1) {
+		img_destroy(&pixmap);
+		return -1;
+	}
+	*src_width = req.src_width;
+	*src_height = req.src_height;
+	free(pixmap.name);
+
+	img->pixels = pixmap.pixels;
+	img->width = pixmap.width;
+	img->height = pixmap.height;
+
+	calc_image_size(*src_width, *src_height, scr, &width, &height);
+	if(img->width != width || img->height != height) {
+		return 1;
+	}
+	imgcache_store(img, fname, cache_variant(scr), *src_width, *src_height);
+	return 0;
+}
+
+/* Returns the image to show on output scr for the image file fname, resampled
+ * to the resolution of that output. Images already loaded at the right size
+ * are shared between outputs. decoded holds the decoded image, if it was
+ * decoded for a previous output, to avoid decoding it again.
+ */
+static struct xlivebg_image *screen_image(const char *fname, int scr, struct img_pixmap *decoded)
+{
+	int width = 0, height = 0, src_width = 0, src_height = 0;
+	int preview = 0;
+	struct xlivebg_image *img;
+	struct image_entry *ent;
+	char pathbuf[PATH_MAX];
+
+	fname = canon_path(fname, pathbuf);
+	if(src_image_size(fname, &src_width, &src_height) != -1) {
+		if((ent = find_screen_image(fname, scr, src_width, src_height))) {
+			ent->last_use = ++lru_clock;
+			return ent->img;
+		}
+		calc_image_size(src_width, src_height, scr, &width, &height);
+	}
+
+	if(!(img = malloc(sizeof *img))) {
+		return 0;
+	}
+	memset(img, 0, sizeof *img);
+
+	if(decoded->pixels && src_width) {
+		struct img_pixmap pixmap;
+
+		img_init(&pixmap);
+		if(img_resample(&pixmap, decoded, width, height) == -1) {
+			free(img);
+			return 0;
+		}
+		img->pixels = pixmap.pixels;
+		img->width = width;
+		img->height = height;
+		imgcache_store(img, fname, cache_variant(scr), src_width, src_height);
+	} else {
+		if(load_image_file(img, fname, scr, decoded, &src_width, &src_height, &preview) == -1) {
+			fprintf(stderr, "xlivebg: failed to load image: %s\n", fname);
+			free(img);
+			return 0;
+		}
+	}
+
+	if(!(ent = add_screen_image(img, fname, scr, src_width, src_height))) {
+		free_pixels(img);
+		free(img);
+		return 0;
+	}
+	ent->preview = preview;
+	if(!preview) {
+		ent->mips = load_mip_chain(fname, img->width, img->height);
+	}
+	return img;
+}
+
+/* finds the size of the original image file, from any image loaded from it */
+static int src_image_size(const char *fname, int *width, int *height)
+{
+	int i;
+	dev_t dev;
+	ino_t ino;
+
+	for(i=file_entry(fname, &dev, &ino); i>=0; i=next_file_entry(images[i].hnext, dev, ino)) {
+		if(images[i].src_width > 0) {
+			*width = images[i].src_width;
+			*height = images[i].src_height;
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/* returns the entry of the image loaded from fname at the size needed by
+ * output scr, if there is one
+ */
+static struct image_entry *find_screen_image(const char *fname, int scr, int src_width, int src_height)
+{
+	int i, width, height;
+	dev_t dev;
+	ino_t ino;
+	struct image_entry *ent;
+
+	calc_image_size(src_width, src_height, scr, &width, &height);
+	for(i=file_entry(fname, &dev, &ino); i>=0; i=next_file_entry(images[i].hnext, dev, ino)) {
+		ent = images + i;
+		if(ent->preview && ent->scr == scr) {
+			return ent;		/* the full image is on its way */
+		}
+		if(ent->src_width > 0 && abs(ent->img->width - width) <= 1 &&
+				abs(ent->img->height - height) <= 1) {
+			return ent;
+		}
+	}
+	return 0;
+}
+
+/* adds an image resampled for output scr, and starts watching its file */
+static struct image_entry *add_screen_image(struct xlivebg_image *img, const char *fname,
+		int scr, int src_width, int src_height)
+{
+	struct image_entry *ent;
+
+	if(!(img->path = strdup(fname)) || add_image(img) == -1) {
+		free(img->path);
+		img->path = 0;
+		return 0;
+	}
+	ent = images + num_images - 1;
+	ent->scr = scr;
+	ent->src_width = src_width;
+	ent->src_height = src_height;
+
+	fwatch_add(fname);
+	return ent;
+}
+
+/* assigns an image to each output, decoding each file at most once */
+static void assign_images(const char *(*getname)(int), void (*setimg)(int, struct xlivebg_image*))
+{
+	int i;
+	struct img_pixmap decoded;
+	const char *fname, *decoded_name = 0;
+	struct xlivebg_image *img;
+
+	img_init(&decoded);
+
+	for(i=0; i<num_screens; i++) {
+		img = 0;
+		/* directories are slideshows, get the current slide */
+		if((fname = slideshow_image(getname(i))) && *fname) {
+			if(decoded_name && strcmp(decoded_name, fname) != 0) {
+				img_destroy(&decoded);
+				img_init(&decoded);
+			}
+			decoded_name = fname;
+			img = screen_image(fname, i, &decoded);
+		}
+		setimg(i, img);
+	}
+
+	img_destroy(&decoded);
+	refine_previews();
+}
+
+/* returns the scale factor which provides exactly one image pixel per screen
+ * pixel on output scr (or on the output needing the most detail if scr is -1),
+ * for the current fit mode
+ */
+static float calc_image_scale(int width, int height, int scr)
+{
+	struct scr_geom geom[MAX_SCR];
+
+	get_scr_geom(geom);
+	return geom_image_scale(geom, num_screens, SCRMASK(scr), width, height);
+}
+
+/* calculates the smallest image size, which still provides at least one image
+ * pixel per screen pixel on output scr, or on every output if scr is -1.
+ * Images are never scaled up.
+ */
+static void calc_image_size(int width, int height, int scr, int *res_width, int *res_height)
+{
+	struct scr_geom geom[MAX_SCR];
+
+	get_scr_geom(geom);
+	geom_image_size(geom, num_screens, SCRMASK(scr), width, height, res_width, res_height);
+}
+
+static void get_scr_geom(struct scr_geom *geom)
+{
+	int i;
+
+	for(i=0; i<num_screens; i++) {
+		geom[i].width = screen[i].width;
+		geom[i].height = screen[i].height;
+		geom[i].fit = xlivebg_fit_mode(i);
+		geom[i].zoom = xlivebg_crop_zoom(i);
+	}
+}
+
+static float geom_image_scale(const struct scr_geom *geom, int num, unsigned int scrmask,
+		int width, int height)
+{
+	int i;
+	float xform[16], sx, sy, scale = 0.0f;
+	float aspect = (float)width / (float)height;
+	static const float cdir[2];
+
+	for(i=0; i<num; i++) {
+		if(!(scrmask & (1u << i))) continue;
+
+		calc_image_proj(geom[i].width, geom[i].height, geom[i].fit, geom[i].zoom, cdir, aspect, xform);
+		sx = geom[i].width * xform[0] / width;
+		sy = geom[i].height * xform[5] / height;
+		if(sx > scale) scale = sx;
+		if(sy > scale) scale = sy;
+	}
+	return scale;
+}
+
+static void geom_image_size(const struct scr_geom *geom, int num, unsigned int scrmask,
+		int width, int height, int *res_width, int *res_height)
+{
+	float scale = geom_image_scale(geom, num, scrmask, width, height);
+
+	if(scale <= 0.0f || scale >= 1.0f) {
+		*res_width = width;
+		*res_height = height;
+	} else {
+		*res_width = (int)ceil(width * scale);
+		*res_height = (int)ceil(height * scale);
+		if(*res_width > width) *res_width = width;
+		if(*res_height > height) *res_height = height;
+	}
+}
+
+static void init_size_req(struct size_req *req, unsigned int scrmask)
+{
+	get_scr_geom(req->geom);
+	req->num_geom = num_screens;
+	req->scrmask = scrmask;
+	req->src_width = req->src_height = 0;
+}
+
+/* img_load_opt target_size callback, called by the decoder with the size of
+ * the image file. May run in the loader thread.
+ */
+static void decode_size(int width, int height, int *res_width, int *res_height, void *cls)
+{
+	struct size_req *req = cls;
+
+	req->src_width = width;
+	req->src_height = height;
+	geom_image_size(req->geom, req->num_geom, req->scrmask, width, height, res_width, res_height);
+}
+
+/* img_load_opt target_size callback for previews: 1/8 of the size of the file,
+ * which is as far as the JPEG decoder can reduce it, unless less is needed
+ */
+static void preview_size(int width, int height, int *res_width, int *res_height, void *cls)
+{
+	decode_size(width, height, res_width, res_height, cls);
+	if(*res_width > (width + 7) / 8 || *res_height > (height + 7) / 8) {
+		*res_width = (width + 7) / 8;
+		*res_height = (height + 7) / 8;
+	}
+}
+
+/* decoding options shared by all image loads: RGBA32 pixels, with HDR images
+ * tone mapped according to the configuration
+ */
+static void init_load_opt(struct img_load_opt *opt)
+{
+	img_load_opt_init(opt);
+	opt->fmt = IMG_FMT_RGBA32;
+	opt->tonemap = cfg.hdr_tonemap;
+	opt->exposure = cfg.hdr_exposure;
+}
+
+/* disk cache variants are derived from the parameters which determine the
+ * resampled size (see calc_image_scale), rather than the output index, so that
+ * instances with the same output configuration share their cache entries.
+ */
+static unsigned int cache_variant(int scr)
+{
+	int i, j;
+	uint32_t hash = 2166136261;
+	uint32_t key[4];
+	unsigned char *kptr = (unsigned char*)key;
+	struct scr_geom geom[MAX_SCR];
+
+	if(scr >= num_screens) scr = -1;
+	get_scr_geom(geom);
+
+	for(i=0; i<num_screens; i++) {
+		if(scr >= 0 && i != scr) continue;
+
+		key[0] = geom[i].width;
+		key[1] = geom[i].height;
+		key[2] = geom[i].fit;
+		memcpy(key + 3, &geom[i].zoom, sizeof geom[i].zoom);
+		for(j=0; j<sizeof key; j++) {
+			hash = (hash ^ kptr[j]) * 16777619;
+		}
+	}
+
+	/* HDR images are tone mapped while decoding. Only non-default settings
+	 * are included, to keep existing entries valid.
+	 */
+	if(cfg.hdr_tonemap != IMG_TONEMAP_CLAMP || cfg.hdr_exposure != 1.0f) {
+		key[0] = cfg.hdr_tonemap;
+		memcpy(key + 1, &cfg.hdr_exposure, sizeof cfg.hdr_exposure);
+		for(j=0; j<2 * sizeof *key; j++) {
+			hash = (hash ^ kptr[j]) * 16777619;
+		}
+	}
+	return hash;
+}
+
+/* releases pixels loaded from the disk cache, or allocated with malloc, along
+ * with their mipmaps
+ */
+static void free_pixels(struct xlivebg_image *img)
+{
+	struct image_entry *ent;
+
+	if(img->pixels && imgcache_unmap(img->pixels) == -1) {
+		free(img->pixels);
+	}
+	img->pixels = 0;
+
+	if((ent = find_entry(img))) {
+		free(ent->mips);
+		ent->mips = 0;
+	}
+}
+
+static int gen_test_image(struct xlivebg_image *img, int width, int height)
+{
+	int i, j;
+	uint32_t *pptr;
+
+	if(create_image(img, width, height, 0) == -1) {
+		return -1;
+	}
+	pptr = img->pixels;
+
+	for(i=0; i<height; i++) {
+		for(j=0; j<width; j++) {
+			int xor = i ^ j;
+
+			uint32_t r = (xor << 1) & 0xff;
+			uint32_t g = xor & 0xff;
+			uint32_t b = (xor >> 1) & 0xff;
+
+			*pptr++ = (r << 16) | (g << 8) | b;
+		}
+	}
+
+	return 0;
+}
+
+void update_texture(struct xlivebg_image *img)
+{
+	int gen_mipmaps;
+	unsigned int tex_fmt;
+	struct image_entry *ent;
+
+	if(!img) return;
 
 	if(!img->tex) {
+		if(upload.img == img) {
+			/* needed right now, finish the upload in progress */
+			upload_chunk(LONG_MAX);
+			return;
+		}
+		if(restore_image(img) == -1) {
+			return;
+		}
 		glGenTextures(1, &img->tex);
 		glBindTexture(GL_TEXTURE_2D, img->tex);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		tex_fmt = tex_format(img, img->pixels);
+		ent = find_entry(img);
+		gen_mipmaps = upload_mipmaps(ent ? ent->mips : 0, img->width, img->height, tex_fmt) == -1;
+		if(gen_mipmaps && !xlivebg_gl_generate_mipmap) {
+			glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP_SGIS, 1);
+		}
+		glTexImage2D(GL_TEXTURE_2D, 0, tex_fmt, img->width, img->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, img->pixels);
+		if(gen_mipmaps && xlivebg_gl_generate_mipmap) {
+			xlivebg_gl_generate_mipmap(GL_TEXTURE_2D);
+		}
+
+		release_pixels(img);
+		trim_image_cache();
+	}
+}
+
+/* Returns the image to display in place of img. If img doesn't have a texture
+ * yet, but another image was displayed before, img is streamed in over the
+ * next few frames, and the previous image is returned until it's done.
+ * The displayed image is referenced, to keep it from being evicted.
+ */
+static struct xlivebg_image *shown_image(struct xlivebg_image *img, struct xlivebg_image **shown)
+{
+	struct xlivebg_image *prev = *shown;
+
+	if(img && !img->tex && prev && prev != img && prev->tex) {
+		/* only one upload at a time, others wait their turn */
+		if(upload.img || begin_upload(img, 0, 0, 0) != -1) {
+			return prev;
+		}
+	}
+
+	update_texture(img);
+	if(img != prev) {
+		if(img) ref_image(img);
+		*shown = img;
+		if(prev) unref_image(prev);
+	}
+	return img;
+}
+
+/* starts streaming pixels to a new texture for img. If pixels is null, the
+ * pixels of img itself are used.
+ */
+static int begin_upload(struct xlivebg_image *img, uint32_t *pixels, int width, int height)
+{
+	struct image_entry *ent;
+
+	upload.mips = 0;
+	if(!pixels) {
+		if(restore_image(img) == -1 || !img->pixels) {
+			return -1;
+		}
+		pixels = img->pixels;
+		width = img->width;
+		height = img->height;
+		if((ent = find_entry(img))) {
+			upload.mips = ent->mips;
+		}
+	}
+
+	glPushAttrib(GL_TEXTURE_BIT);
+	glGenTextures(1, &upload.tex);
+	glBindTexture(GL_TEXTURE_2D, upload.tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	upload.tex_fmt = tex_format(img, pixels);
+	glTexImage2D(GL_TEXTURE_2D, 0, upload.tex_fmt, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glPopAttrib();
+
+	upload.pbo = 0;
+	if(xlivebg_have_pbo) {
+		xlivebg_gl_gen_buffers(1, &upload.pbo);
+	}
+	upload.img = img;
+	upload.pixels = pixels;
+	upload.width = width;
+	upload.height = height;
+	upload.replace = 0;
+	upload.next_row = 0;
+	return 0;
+}
+
+/* Uploads the next maxbytes worth of rows of the image being streamed, through
+ * a pixel buffer object if available, to let the transfer proceed
+ * asynchronously. Mipmaps are uploaded with the last chunk, or generated after
+ * it. Returns 1 when the upload is complete.
+ */
+static int upload_chunk(long maxbytes)
+{
+	struct xlivebg_image *img = upload.img;
+	long rowsz = upload.width * 4;
+	long rows = maxbytes / rowsz;
+	int last, gen_mipmaps;
+	void *src, *dest = 0;
+
+	if(rows < 1) rows = 1;
+	if(rows > upload.height - upload.next_row) {
+		rows = upload.height - upload.next_row;
+	}
+	last = upload.next_row + rows >= upload.height;
+	src = upload.pixels + upload.next_row * upload.width;
+
+	glPushAttrib(GL_TEXTURE_BIT);
+	glBindTexture(GL_TEXTURE_2D, upload.tex);
+
+	gen_mipmaps = last && upload_mipmaps(upload.mips, upload.width, upload.height, upload.tex_fmt) == -1;
+
+	if(gen_mipmaps && !xlivebg_gl_generate_mipmap) {
+		/* the driver will regenerate the mipmaps when the last chunk lands */
 		glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP_SGIS, 1);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, img->width, img->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, img->pixels);
+	}
+
+	if(upload.pbo) {
+		xlivebg_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, upload.pbo);
+		/* orphan the previous buffer, to avoid waiting for the last transfer */
+		xlivebg_gl_buffer_data(GL_PIXEL_UNPACK_BUFFER, rows * rowsz, 0, GL_STREAM_DRAW);
+		if((dest = xlivebg_gl_map_buffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY))) {
+			memcpy(dest, src, rows * rowsz);
+			xlivebg_gl_unmap_buffer(GL_PIXEL_UNPACK_BUFFER);
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload.next_row, upload.width, rows,
+					GL_RGBA, GL_UNSIGNED_BYTE, 0);
+		}
+		xlivebg_gl_bind_buffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	if(!dest) {
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, upload.next_row, upload.width, rows,
+				GL_RGBA, GL_UNSIGNED_BYTE, src);
+	}
+	upload.next_row += rows;
+
+	if(gen_mipmaps && xlivebg_gl_generate_mipmap) {
+		xlivebg_gl_generate_mipmap(GL_TEXTURE_2D);
+	}
+	glPopAttrib();
+
+	if(last) {
+		if(upload.replace) {
+			glDeleteTextures(1, &img->tex);
+			install_pixels(img, upload.pixels, upload.width, upload.height, upload.mips);
+			upload.replace = 0;
+		}
+		img->tex = upload.tex;
+		upload.tex = 0;
+		cancel_upload();
+		release_pixels(img);
+		trim_image_cache();
+		return 1;
+	}
+	return 0;
+}
+
+/* Uploads the mipmaps of the texture bound to GL_TEXTURE_2D from a mipmap
+ * chain, if there is one for the size of the texture. Returns -1 if the
+ * mipmaps have to be generated instead.
+ */
+static int upload_mipmaps(struct mip_chain *mips, int width, int height, unsigned int tex_fmt)
+{
+	int i;
+	uint32_t *pixels;
+
+	if(!mips || mips->width != width || mips->height != height) {
+		return -1;
+	}
+
+	pixels = mips->pixels;
+	for(i=1; i<=mips->num_levels; i++) {
+		if(width > 1) width >>= 1;
+		if(height > 1) height >>= 1;
+		glTexImage2D(GL_TEXTURE_2D, i, tex_fmt, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		pixels += width * height;
+	}
+	return 0;
+}
+
+/* Reads the levels below the one of the specified size from fname, if it's a
+ * mipmap container, decompressing them if needed. The file isn't kept open or
+ * mapped afterwards. Called by the loader thread too.
+ */
+static struct mip_chain *load_mip_chain(const char *fname, int width, int height)
+{
+	int i, base;
+	long size = 0, lvlsz;
+	FILE *fp;
+	char magic[4];
+	unsigned char *dest;
+	void *pixels;
+	struct img_mipmap mip;
+	struct mip_chain *mips;
+
+	/* check the signature first, to avoid mapping every other image file */
+	if(!(fp = fopen(fname, "rb"))) {
+		return 0;
+	}
+	i = fread(magic, 1, sizeof magic, fp);
+	fclose(fp);
+	if(i < 4 || memcmp(magic, "IMIP", 4) != 0 || img_load_mipmap(&mip, fname) == -1) {
+		return 0;
+	}
+
+	for(base=0; base<mip.num_levels; base++) {
+		if(mip.level[base].width == width && mip.level[base].height == height) {
+			break;
+		}
+	}
+	for(i=base + 1; i<mip.num_levels; i++) {
+		size += (long)mip.level[i].width * mip.level[i].height * 4;
+	}
+	if(base >= mip.num_levels - 1 || !(mips = malloc(sizeof *mips + size))) {
+		img_destroy_mipmap(&mip);
+		return 0;
+	}
+	mips->width = width;
+	mips->height = height;
+	mips->num_levels = mip.num_levels - base - 1;
+	mips->pixels = (uint32_t*)(mips + 1);
+
+	dest = (unsigned char*)mips->pixels;
+	for(i=base + 1; i<mip.num_levels; i++) {
+		if(!(pixels = img_mipmap_pixels(&mip, i))) {
+			fprintf(stderr, "xlivebg: failed to read mipmap level %d of %s\n", i, fname);
+			free(mips);
+			img_destroy_mipmap(&mip);
+			return 0;
+		}
+		lvlsz = (long)mip.level[i].width * mip.level[i].height * 4;
+		memcpy(dest, pixels, lvlsz);
+		dest += lvlsz;
+	}
+	img_destroy_mipmap(&mip);
+	return mips;
+}
+
+static void cancel_upload(void)
+{
+	struct xlivebg_image *img = upload.img;
+
+	if(upload.replace) {
+		/* keep the reloaded pixels, the texture will be recreated on demand */
+		if(img->tex) {
+			glDeleteTextures(1, &img->tex);
+			img->tex = 0;
+		}
+		install_pixels(img, upload.pixels, upload.width, upload.height, upload.mips);
+		upload.replace = 0;
+	}
+	upload.mips = 0;
+	if(upload.tex) {
+		glDeleteTextures(1, &upload.tex);
+		upload.tex = 0;
+	}
+	if(upload.pbo) {
+		xlivebg_gl_delete_buffers(1, &upload.pbo);
+		upload.pbo = 0;
+	}
+	upload.img = 0;
+}
+
+/* replaces the pixels of img with the reloaded ones, and their mipmaps, which
+ * are freed if img isn't in the image list
+ */
+static void install_pixels(struct xlivebg_image *img, uint32_t *pixels, int width, int height,
+		struct mip_chain *mips)
+{
+	struct image_entry *ent;
+
+	free_pixels(img);
+	img->pixels = pixels;
+	img->width = width;
+	img->height = height;
+
+	if((ent = find_entry(img))) {
+		ent->opaque = -1;
+		ent->mips = mips;
+	} else {
+		free(mips);
+	}
+}
+
+/* worker thread: decodes the image file */
+static void load_decode(void *data)
+{
+	struct load_job *job = data;
+
+	struct img_load_opt opt;
+
+	init_load_opt(&opt);
+	opt.target_size = decode_size;
+	opt.cls = &job->req;
+
+	if(img_load_ex(&job->pixmap, job->path, &opt) == -1) {
+		img_destroy(&job->pixmap);
+		img_init(&job->pixmap);
+		return;
+	}
+	job->mips = load_mip_chain(job->path, job->pixmap.width, job->pixmap.height);
+}
+
+/* worker thread: resamples the decoded image for each target. The size of each
+ * target is passed in the width/height fields of its pixmap.
+ */
+static void load_resample(void *data)
+{
+	int i;
+	struct load_job *job = data;
+
+	for(i=0; i<job->num_targets; i++) {
+		struct load_target *tg = job->targets + i;
+		int width = tg->pixmap.width;
+		int height = tg->pixmap.height;
+
+		img_init(&tg->pixmap);
+		if(width != job->pixmap.width || height != job->pixmap.height) {
+			img_resample(&tg->pixmap, &job->pixmap, width, height);
+		} else {
+			img_copy(&tg->pixmap, &job->pixmap);
+		}
+	}
+}
+
+static struct load_job *alloc_load_job(const char *path)
+{
+	struct load_job *job;
+
+	if(!(job = calloc(1, sizeof *job)) || !(job->path = strdup(path))) {
+		free(job);
+		return 0;
+	}
+	img_init(&job->pixmap);
+	return job;
+}
+
+static void free_load_job(struct load_job *job)
+{
+	int i;
+
+	for(i=0; i<job->num_targets; i++) {
+		img_destroy(&job->targets[i].pixmap);
+	}
+	free(job->targets);
+	img_destroy(&job->pixmap);
+	free(job->mips);
+	free(job->path);
+	free(job);
+}
+
+/* adds a resampling target of the specified size, unless there is one already */
+static struct load_target *add_target(struct load_job *job, int width, int height)
+{
+	int i;
+	struct load_target *tg;
+
+	for(i=0; i<job->num_targets; i++) {
+		tg = job->targets + i;
+		if(!tg->img && tg->pixmap.width == width && tg->pixmap.height == height) {
+			return 0;
+		}
+	}
+	tg = job->targets + job->num_targets++;
+	tg->img = 0;
+	tg->scr = -1;
+	img_init(&tg->pixmap);
+	tg->pixmap.width = width;
+	tg->pixmap.height = height;
+	return tg;
+}
+
+/* hands the mipmaps of the decoded image over to the first target of the same
+ * size, if the file was a mipmap container
+ */
+static struct mip_chain *take_mips(struct load_job *job, struct load_target *tg)
+{
+	struct mip_chain *mips = job->mips;
+
+	if(!mips || mips->width != tg->pixmap.width || mips->height != tg->pixmap.height) {
+		return 0;
+	}
+	job->mips = 0;
+	return mips;
+}
+
+/* main thread: decides the size of each image loaded from the file, and hands
+ * the resampling back to the worker thread
+ */
+static void reload_decode_done(void *data)
+{
+	int i, width, height;
+	struct load_job *job = data;
+	struct load_target *tg;
+
+	if(!job->pixmap.pixels) {
+		fprintf(stderr, "xlivebg: failed to reload image: %s\n", job->path);
+		goto fail;
+	}
+
+	if(!(job->targets = malloc(num_images * sizeof *job->targets))) {
+		goto fail;
+	}
+	for(i=0; i<num_images; i++) {
+		struct image_entry *ent = images + i;
+		if(ent->reloading && strcmp(ent->img->path, job->path) == 0) {
+			calc_image_size(job->req.src_width, job->req.src_height,
+					ent->scr < num_screens ? ent->scr : -1, &width, &height);
+			tg = job->targets + job->num_targets++;
+			img_init(&tg->pixmap);
+			tg->img = ent->img;
+			tg->scr = ent->scr;
+			tg->pixmap.width = width;
+			tg->pixmap.height = height;
+		}
+	}
+
+	loader_submit(load_resample, reload_resample_done, job);
+	return;
+
+fail:
+	for(i=0; i<num_images; i++) {
+		if(images[i].reloading && strcmp(images[i].img->path, job->path) == 0) {
+			images[i].reloading = 0;
+		}
+	}
+	free_load_job(job);
+}
+
+/* main thread: swaps in the new pixels of each image loaded from the file.
+ * Images which are on the GPU, or being uploaded, keep their old texture until
+ * the new one is uploaded by update_image_uploads.
+ */
+static void reload_resample_done(void *data)
+{
+	int i, again = 0;
+	struct load_job *job = data;
+
+	for(i=0; i<job->num_targets; i++) {
+		struct load_target *tg = job->targets + i;
+		struct image_entry *ent = find_entry(tg->img);
+
+		if(!ent) continue;
+		if(ent->reloading == 2) again = 1;
+		ent->reloading = 0;
+
+		if(!tg->pixmap.pixels) {
+			fprintf(stderr, "xlivebg: failed to resize reloaded image %s\n", job->path);
+			continue;
+		}
+		ent->src_width = job->req.src_width;
+		ent->src_height = job->req.src_height;
+		ent->preview = 0;
+
+		/* the file may have been replaced by a new one */
+		hash_remove(ent - images);
+		hash_insert(ent - images);
+
+		if(tg->img->tex || upload.img == tg->img) {
+			struct xlivebg_image tmp;
+
+			memset(&tmp, 0, sizeof tmp);
+			tmp.pixels = tg->pixmap.pixels;
+			tmp.width = tg->pixmap.width;
+			tmp.height = tg->pixmap.height;
+			imgcache_store(&tmp, job->path, cache_variant(ent->scr), ent->src_width, ent->src_height);
+
+			if(ent->new_pixels) free(ent->new_pixels);
+			free(ent->new_mips);
+			ent->opaque = -1;
+			ent->new_pixels = tg->pixmap.pixels;
+			ent->new_mips = take_mips(job, tg);
+			ent->new_width = tg->pixmap.width;
+			ent->new_height = tg->pixmap.height;
+		} else {
+			install_pixels(tg->img, tg->pixmap.pixels, tg->pixmap.width, tg->pixmap.height,
+					take_mips(job, tg));
+			imgcache_store(tg->img, job->path, cache_variant(ent->scr), ent->src_width, ent->src_height);
+		}
+		tg->pixmap.pixels = 0;
+	}
+
+	if(again) {
+		reload_image_file(job->path);
+	}
+	free_load_job(job);
+}
+
+/* Loads the image file fname for each output in scrmask in the background, and
+ * uploads it to the GPU, so that it can be shown later without any delay.
+ * done is called when the pixels are ready (not necessarily the textures),
+ * with 0 on success or -1 on failure. It may be called before returning, if
+ * nothing needs to be decoded.
+ */
+int prefetch_image(const char *fname, unsigned int scrmask, void (*done)(int, void*), void *cls)
+{
+	int i;
+	unsigned int missing = 0;
+	struct load_job *job;
+	char pathbuf[PATH_MAX];
+
+	fname = canon_path(fname, pathbuf);
+
+	/* images already loaded, or in the disk cache, don't need to be decoded */
+	for(i=0; i<num_screens; i++) {
+		if((scrmask & (1u << i)) && !prefetch_cached(fname, i)) {
+			missing |= 1 << i;
+		}
+	}
+	if(!missing) {
+		done(0, cls);
+		return 0;
+	}
+
+	if(!(job = alloc_load_job(fname))) {
+		done(-1, cls);
+		return -1;
+	}
+	init_size_req(&job->req, missing);
+	job->done = done;
+	job->cls = cls;
+	return loader_submit(load_decode, prefetch_decode_done, job);
+}
+
+/* marks the image of fname for output scr as prefetched, if it's already in
+ * memory, or can be mapped from the disk cache. Returns 0 if it needs decoding.
+ */
+static int prefetch_cached(const char *fname, int scr)
+{
+	int width, height, src_width, src_height;
+	struct image_entry *ent = 0;
+	struct xlivebg_image *img, tmp;
+
+	if(src_image_size(fname, &src_width, &src_height) != -1) {
+		ent = find_screen_image(fname, scr, src_width, src_height);
+	}
+	if(ent && (ent->img->pixels || ent->img->tex)) {
+		ent->prefetch = 1;
+		return 1;
+	}
+
+	memset(&tmp, 0, sizeof tmp);
+	if(imgcache_load(&tmp, fname, cache_variant(scr), &src_width, &src_height) == -1) {
+		return 0;
+	}
+	calc_image_size(src_width, src_height, scr, &width, &height);
+	if(tmp.width != width || tmp.height != height) {
+		imgcache_unmap(tmp.pixels);
+		return 0;
+	}
+
+	if(ent) {
+		/* previously evicted */
+		install_pixels(ent->img, tmp.pixels, tmp.width, tmp.height,
+				load_mip_chain(fname, tmp.width, tmp.height));
+		ent->prefetch = 1;
+		return 1;
+	}
+	if(!(img = malloc(sizeof *img))) {
+		imgcache_unmap(tmp.pixels);
+		return 0;
+	}
+	*img = tmp;
+	if(!(ent = add_screen_image(img, fname, scr, src_width, src_height))) {
+		free_pixels(img);
+		free(img);
+		return 0;
+	}
+	ent->prefetch = 1;
+	ent->mips = load_mip_chain(fname, img->width, img->height);
+	return 1;
+}
+
+static void prefetch_decode_done(void *data)
+{
+	int i, width, height;
+	struct load_job *job = data;
+	struct load_target *tg;
+
+	if(!job->pixmap.pixels) {
+		fprintf(stderr, "xlivebg: failed to load image: %s\n", job->path);
+		job->done(-1, job->cls);
+		free_load_job(job);
+		return;
+	}
+
+	if(!(job->targets = malloc(num_screens * sizeof *job->targets))) {
+		job->done(-1, job->cls);
+		free_load_job(job);
+		return;
+	}
+	for(i=0; i<num_screens; i++) {
+		if(job->req.scrmask & (1u << i)) {
+			calc_image_size(job->req.src_width, job->req.src_height, i, &width, &height);
+			if((tg = add_target(job, width, height))) {
+				tg->scr = i;
+			}
+		}
+	}
+
+	loader_submit(load_resample, prefetch_resample_done, job);
+}
+
+static void prefetch_resample_done(void *data)
+{
+	int i, res = -1;
+	struct load_job *job = data;
+	int src_width = job->req.src_width;
+	int src_height = job->req.src_height;
+
+	for(i=0; i<job->num_targets; i++) {
+		struct load_target *tg = job->targets + i;
+		struct image_entry *ent;
+		struct xlivebg_image *img;
+
+		if(!tg->pixmap.pixels) continue;
+
+		if((ent = find_screen_image(job->path, tg->scr, src_width, src_height))) {
+			/* loaded in the meantime, or previously evicted */
+			if(!ent->img->pixels && !ent->img->tex) {
+				install_pixels(ent->img, tg->pixmap.pixels, tg->pixmap.width, tg->pixmap.height,
+						take_mips(job, tg));
+				tg->pixmap.pixels = 0;
+			}
+		} else {
+			if(!(img = calloc(1, sizeof *img))) {
+				continue;
+			}
+			img->pixels = tg->pixmap.pixels;
+			img->width = tg->pixmap.width;
+			img->height = tg->pixmap.height;
+			if(!(ent = add_screen_image(img, job->path, tg->scr, src_width, src_height))) {
+				free(img);
+				continue;
+			}
+			tg->pixmap.pixels = 0;
+			ent->mips = take_mips(job, tg);
+		}
+		ent->prefetch = 1;
+		imgcache_store(ent->img, job->path, cache_variant(tg->scr), src_width, src_height);
+		res = 0;
+	}
+
+	job->done(res, job->cls);
+	free_load_job(job);
+}
+
+/* returns the background image selected for output scr, or the test image */
+static struct xlivebg_image *bg_image(int scr)
+{
+	if(bg[scr]) {
+		return bg[scr];
+	}
+
+	/* generate the test image on demand, if no background image is set */
+	if(!testimg) {
+		if(!(testimg = malloc(sizeof *testimg))) {
+			return 0;
+		}
+		if(gen_test_image(testimg, 1920, 1080) == -1) {
+			free(testimg);
+			testimg = 0;
+			return 0;
+		}
+		add_image(testimg);
+	}
+	return testimg;
+}
+
+/* from must already be referenced, the reference is dropped by end_crossfade */
+static void begin_crossfade(int scr, struct xlivebg_image *from, struct xlivebg_image *to)
+{
+	struct crossfade *xf = xfade + scr;
+
+	end_crossfade(scr);
+
+	xf->img.width = to->width;
+	xf->img.height = to->height;
+
+	glPushAttrib(GL_TEXTURE_BIT);
+	glGenTextures(1, &xf->img.tex);
+	glBindTexture(GL_TEXTURE_2D, xf->img.tex);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, to->width, to->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glPopAttrib();
+
+	xlivebg_gl_gen_framebuffers(1, &xf->fbo);
+	xlivebg_gl_bind_framebuffer(GL_FRAMEBUFFER, xf->fbo);
+	xlivebg_gl_framebuffer_texture2d(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, xf->img.tex, 0);
+	if(xlivebg_gl_check_framebuffer_status(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+		fprintf(stderr, "xlivebg: incomplete framebuffer, crossfade disabled\n");
+		xlivebg_gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+		xlivebg_gl_delete_framebuffers(1, &xf->fbo);
+		glDeleteTextures(1, &xf->img.tex);
+		xf->fbo = xf->img.tex = 0;
+		unref_image(from);
+		return;
+	}
+	xlivebg_gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+
+	xf->from = from;
+	xf->to = to;
+	xf->start = msec;
+	draw_crossfade(scr, 0.0f);
+}
+
+static void end_crossfade(int scr)
+{
+	struct crossfade *xf = xfade + scr;
+
+	if(xf->fbo) {
+		xlivebg_gl_delete_framebuffers(1, &xf->fbo);
+		xf->fbo = 0;
+	}
+	if(xf->img.tex) {
+		glDeleteTextures(1, &xf->img.tex);
+		xf->img.tex = 0;
+	}
+	if(xf->from) {
+		unref_image(xf->from);
+		xf->from = xf->to = 0;
+	}
+}
+
+/* Renders the crossfade to its texture, which has the size of the image we're
+ * fading to, so that plugins can use it in its place. The image we're fading
+ * from is cropped to cover it, if the aspect ratios differ.
+ */
+static void draw_crossfade(int scr, float t)
+{
+	int prog = 0;
+	struct crossfade *xf = xfade + scr;
+	float from_aspect = (float)xf->from->width / xf->from->height;
+	float to_aspect = (float)xf->to->width / xf->to->height;
+	float u = 0.0f, v = 0.0f;
+
+	if(from_aspect > to_aspect) {
+		u = (1.0f - to_aspect / from_aspect) * 0.5f;
+	} else {
+		v = (1.0f - from_aspect / to_aspect) * 0.5f;
+	}
+
+	if(xlivebg_gl_use_program) {
+		glGetIntegerv(GL_CURRENT_PROGRAM, &prog);
+		xlivebg_gl_use_program(0);
+	}
+	xlivebg_gl_bind_framebuffer(GL_FRAMEBUFFER, xf->fbo);
+	glPushAttrib(GL_ENABLE_BIT | GL_VIEWPORT_BIT | GL_TEXTURE_BIT | GL_COLOR_BUFFER_BIT | GL_CURRENT_BIT);
+	glViewport(0, 0, xf->img.width, xf->img.height);
+
+	glMatrixMode(GL_TEXTURE);
+	glPushMatrix();
+	glLoadIdentity();
+	glMatrixMode(GL_PROJECTION);
+	glPushMatrix();
+	glLoadIdentity();
+	glMatrixMode(GL_MODELVIEW);
+	glPushMatrix();
+	glLoadIdentity();
+
+	glActiveTexture(GL_TEXTURE0);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_LIGHTING);
+	glDisable(GL_ALPHA_TEST);
+	glDisable(GL_BLEND);
+	glEnable(GL_TEXTURE_2D);
+	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_MODULATE);
+
+	glBindTexture(GL_TEXTURE_2D, xf->from->tex);
+	glBegin(GL_QUADS);
+	glColor4f(1, 1, 1, 1);
+	glTexCoord2f(u, v);
+	glVertex2f(-1, -1);
+	glTexCoord2f(1.0f - u, v);
+	glVertex2f(1, -1);
+	glTexCoord2f(1.0f - u, 1.0f - v);
+	glVertex2f(1, 1);
+	glTexCoord2f(u, 1.0f - v);
+	glVertex2f(-1, 1);
+	glEnd();
+
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+	glBindTexture(GL_TEXTURE_2D, xf->to->tex);
+	glBegin(GL_QUADS);
+	glColor4f(1, 1, 1, t);
+	glTexCoord2f(0, 0);
+	glVertex2f(-1, -1);
+	glTexCoord2f(1, 0);
+	glVertex2f(1, -1);
+	glTexCoord2f(1, 1);
+	glVertex2f(1, 1);
+	glTexCoord2f(0, 1);
+	glVertex2f(-1, 1);
+	glEnd();
+
+	glMatrixMode(GL_TEXTURE);
+	glPopMatrix();
+	glMatrixMode(GL_PROJECTION);
+	glPopMatrix();
+	glMatrixMode(GL_MODELVIEW);
+	glPopMatrix();
+
+	glPopAttrib();
+	xlivebg_gl_bind_framebuffer(GL_FRAMEBUFFER, 0);
+	if(prog) {
+		xlivebg_gl_use_program(prog);
 	}
 }
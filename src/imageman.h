@@ -20,9 +20,9 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include "xlivebg.h"
 
-/* XXX: all the scr arguments are ignored at the moment */
-
 void init_imgman(void);
+/* assigns images to outputs, according to the global and per-output settings */
+void update_screen_images(void);
 
 void destroy_all_textures(void);
 
@@ -40,11 +40,34 @@ int get_image_count(void);
 
 int find_image(const char *name);
 
+/* evicts unused images until the cache fits in cfg.cache_ram/cfg.cache_vram */
+void trim_image_cache(void);
+/* drops images loaded at a resolution which doesn't match the outputs anymore */
+void update_image_sizes(void);
+
 int dump_image_tex(struct xlivebg_image *img, const char *fname);
 
+/* returns the pixels of img, which are otherwise dropped after uploading */
+uint32_t *get_image_pixels(struct xlivebg_image *img);
+
 struct xlivebg_image *get_bg_image(int scr);
 struct xlivebg_image *get_anim_mask(int scr);
 
+/* streams texture uploads in progress, must be called once per frame */
+void update_image_uploads(void);
+int image_upload_pending(void);
+
+/* renders crossfades between background images, must be called once per frame */
+void update_crossfades(void);
+
+/* called when an image file changes on disk, reloads all images loaded from it */
+void reload_image_file(const char *path);
+/* reloads all images loaded from files, after a change to how they're decoded */
+void reload_images(void);
+
+/* loads an image file ahead of time for the outputs in scrmask (bitmask) */
+int prefetch_image(const char *fname, unsigned int scrmask, void (*done)(int, void*), void *cls);
+
 void set_bg_image(int scr, struct xlivebg_image *img);
 void set_anim_mask(int scr, struct xlivebg_image *img);
 
@@ -0,0 +1,439 @@
+/*
+xlivebg - live wallpapers for the X window system
+Copyright (C) 2019-2020  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifndef __FreeBSD__
+#include <alloca.h>
+#endif
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <utime.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "imgcache.h"
+#include "util.h"
+#include "cfg.h"
+
+#define CACHE_MAGIC		"XLBGIMG"
+#define CACHE_VERSION	4
+#define CACHE_SUFFIX	".img"
+
+struct cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t width, height;
+	uint32_t src_width, src_height;	/* size of the source image before resampling */
+	uint32_t pathlen;		/* length of the source path, which follows the header */
+	uint32_t data_offs;		/* offset of the pixel data from the start of the file */
+	uint32_t variant;		/* distinguishes differently sized copies of the same image */
+	uint64_t src_size;		/* size and modification time of the source image */
+	int64_t src_mtime;
+	uint64_t src_dev, src_ino;	/* identity of the source image file */
+};
+
+struct mapping {
+	void *addr, *pixels;
+	size_t size;
+	int readonly;
+	struct mapping *next;
+};
+
+static char *cache_path(const struct stat *st, unsigned int variant);
+static void prune_cache(void);
+
+static char *cachedir;
+static int shared;
+static uid_t trusted_uid;	/* owner of shared entries, besides ourselves */
+static struct mapping *maplist;
+
+
+int imgcache_init(void)
+{
+	char *env, *ptr;
+	int mode = 0755;
+	struct stat st;
+	struct passwd *pw;
+
+	trusted_uid = getuid();
+
+	if(cfg.shared_cache && *cfg.shared_cache) {
+		/* world-writable with the sticky bit, like /tmp, so that the instances
+		 * of every user can add entries, but not remove those of others
+		 */
+		if(!(cachedir = strdup(cfg.shared_cache))) {
+			return -1;
+		}
+		shared = 1;
+		mode = 01777;
+
+		if(cfg.shared_cache_owner && *cfg.shared_cache_owner) {
+			if((pw = getpwnam(cfg.shared_cache_owner))) {
+				trusted_uid = pw->pw_uid;
+			} else {
+				fprintf(stderr, "imgcache_init: unknown shared cache owner: %s\n",
+						cfg.shared_cache_owner);
+			}
+		}
+	} else if((env = getenv("XDG_CACHE_HOME")) && *env) {
+		if(!(cachedir = malloc(strlen(env) + 16))) {
+			return -1;
+		}
+		sprintf(cachedir, "%s/xlivebg", env);
+	} else {
+		char *home = get_home_dir();
+		if(!(cachedir = malloc(strlen(home) + 32))) {
+			return -1;
+		}
+		sprintf(cachedir, "%s/.cache/xlivebg", home);
+	}
+
+	/* create any missing path components */
+	ptr = cachedir;
+	while((ptr = strchr(ptr + 1, '/'))) {
+		*ptr = 0;
+		mkdir(cachedir, 0755);
+		*ptr = '/';
+	}
+	if(mkdir(cachedir, mode) == -1) {
+		if(errno != EEXIST) {
+			fprintf(stderr, "imgcache_init: failed to create cache directory: %s: %s\n",
+					cachedir, strerror(errno));
+			free(cachedir);
+			cachedir = 0;
+			return -1;
+		}
+	} else if(shared) {
+		chmod(cachedir, mode);	/* mkdir is subject to the umask */
+	}
+	/* anyone able to write to the directory could remove or rename our entries,
+	 * unless the sticky bit is set
+	 */
+	if(shared && (lstat(cachedir, &st) == -1 || !S_ISDIR(st.st_mode) ||
+			((st.st_mode & (S_IWGRP | S_IWOTH)) && !(st.st_mode & S_ISVTX)))) {
+		fprintf(stderr, "imgcache_init: refusing to use insecure cache directory: %s\n", cachedir);
+		free(cachedir);
+		cachedir = 0;
+		return -1;
+	}
+	if(shared) {
+		printf("Using shared image cache: %s\n", cachedir);
+	}
+	return 0;
+}
+
+int imgcache_load(struct xlivebg_image *img, const char *fname, unsigned int variant,
+		int *src_width, int *src_height)
+{
+	int fd;
+	struct stat st, cst;
+	struct cache_header *hdr;
+	struct mapping *m;
+	char *path;
+	void *map;
+	size_t datasz;
+
+	if(!cachedir || !cfg.disk_cache || stat(fname, &st) == -1) {
+		return -1;
+	}
+
+	path = cache_path(&st, variant);
+	if((fd = open(path, O_RDONLY | O_NOFOLLOW)) == -1) {
+		return -1;
+	}
+	/* only trust entries written by ourselves, or by the configured owner of the
+	 * shared cache, which nobody else can modify
+	 */
+	if(fstat(fd, &cst) == -1 || !S_ISREG(cst.st_mode) || cst.st_size < sizeof *hdr ||
+			(cst.st_uid != getuid() && cst.st_uid != trusted_uid) ||
+			(cst.st_mode & (S_IWGRP | S_IWOTH))) {
+		close(fd);
+		return -1;
+	}
+	/* entries of the shared cache are mapped read-only, so that every instance
+	 * keeps referencing the same physical pages
+	 */
+	if(shared) {
+		map = mmap(0, cst.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	} else {
+		map = mmap(0, cst.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	}
+	close(fd);
+	if(map == MAP_FAILED) {
+		return -1;
+	}
+	hdr = map;
+	datasz = (size_t)hdr->width * hdr->height * 4;
+
+	if(memcmp(hdr->magic, CACHE_MAGIC, sizeof hdr->magic) != 0 ||
+			hdr->version != CACHE_VERSION || hdr->variant != variant ||
+			hdr->src_size != (uint64_t)st.st_size || hdr->src_mtime != (int64_t)st.st_mtime ||
+			hdr->src_dev != (uint64_t)st.st_dev || hdr->src_ino != (uint64_t)st.st_ino ||
+			hdr->data_offs > (size_t)cst.st_size || datasz > (size_t)cst.st_size - hdr->data_offs) {
+		munmap(map, cst.st_size);
+		return -1;
+	}
+
+	if(!(m = malloc(sizeof *m))) {
+		munmap(map, cst.st_size);
+		return -1;
+	}
+	m->addr = map;
+	m->size = cst.st_size;
+	m->pixels = (char*)map + hdr->data_offs;
+	m->readonly = shared;
+	m->next = maplist;
+	maplist = m;
+
+	img->pixels = m->pixels;
+	img->width = hdr->width;
+	img->height = hdr->height;
+	*src_width = hdr->src_width;
+	*src_height = hdr->src_height;
+
+	utime(path, 0);	/* update the timestamp used for pruning old entries */
+	return 0;
+}
+
+int imgcache_store(struct xlivebg_image *img, const char *fname, unsigned int variant,
+		int src_width, int src_height)
+{
+	int fd;
+	FILE *fp;
+	struct stat st;
+	struct cache_header hdr;
+	char *path, *tmppath;
+	static const char zeros[16];
+	size_t datasz;
+
+	if(!cachedir || !cfg.disk_cache || !img->pixels) {
+		return -1;
+	}
+	if(imgcache_ismapped(img->pixels)) {
+		return 0;	/* came from the cache in the first place */
+	}
+	if(stat(fname, &st) == -1) {
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof hdr);
+	memcpy(hdr.magic, CACHE_MAGIC, sizeof hdr.magic);
+	hdr.version = CACHE_VERSION;
+	hdr.width = img->width;
+	hdr.height = img->height;
+	hdr.src_width = src_width;
+	hdr.src_height = src_height;
+	hdr.variant = variant;
+	hdr.pathlen = strlen(fname);
+	hdr.data_offs = (sizeof hdr + hdr.pathlen + 15) & ~15;
+	hdr.src_size = st.st_size;
+	hdr.src_mtime = st.st_mtime;
+	hdr.src_dev = st.st_dev;
+	hdr.src_ino = st.st_ino;
+	datasz = (size_t)img->width * img->height * 4;
+
+	/* write to a temporary file and rename, to avoid leaving partial entries.
+	 * mkstemp creates it exclusively, with a name others can't predict.
+	 */
+	path = cache_path(&st, variant);
+	tmppath = alloca(strlen(path) + 16);
+	sprintf(tmppath, "%s.XXXXXX", path);
+
+	if((fd = mkstemp(tmppath)) == -1 || !(fp = fdopen(fd, "wb"))) {
+		fprintf(stderr, "imgcache_store: failed to create %s: %s\n", tmppath, strerror(errno));
+		if(fd != -1) {
+			close(fd);
+			remove(tmppath);
+		}
+		return -1;
+	}
+	if(shared) {
+		fchmod(fd, 0644);
+	}
+	if(fwrite(&hdr, sizeof hdr, 1, fp) < 1 ||
+			fwrite(fname, 1, hdr.pathlen, fp) < hdr.pathlen ||
+			fwrite(zeros, 1, hdr.data_offs - sizeof hdr - hdr.pathlen, fp) < hdr.data_offs - sizeof hdr - hdr.pathlen ||
+			fwrite(img->pixels, 1, datasz, fp) < datasz) {
+		fprintf(stderr, "imgcache_store: failed to write %s: %s\n", tmppath, strerror(errno));
+		fclose(fp);
+		remove(tmppath);
+		return -1;
+	}
+	if(fclose(fp) == -1 || rename(tmppath, path) == -1) {
+		remove(tmppath);
+		return -1;
+	}
+
+	prune_cache();
+	return 0;
+}
+
+int imgcache_ismapped(void *pixels)
+{
+	struct mapping *m = maplist;
+	while(m) {
+		if(m->pixels == pixels) return 1;
+		m = m->next;
+	}
+	return 0;
+}
+
+int imgcache_isreadonly(void *pixels)
+{
+	struct mapping *m = maplist;
+	while(m) {
+		if(m->pixels == pixels) return m->readonly;
+		m = m->next;
+	}
+	return 0;
+}
+
+int imgcache_unmap(void *pixels)
+{
+	struct mapping dummy, *prev, *m;
+
+	dummy.next = maplist;
+	prev = &dummy;
+	while(prev->next) {
+		m = prev->next;
+		if(m->pixels == pixels) {
+			prev->next = m->next;
+			maplist = dummy.next;
+			munmap(m->addr, m->size);
+			free(m);
+			return 0;
+		}
+		prev = m;
+	}
+	return -1;
+}
+
+/* cache entries are named after a 64bit FNV-1a hash of the identity of the
+ * source file and the variant number. The path is not part of the key, so that
+ * the same file reached through different paths maps to the same entry.
+ */
+static char *cache_path(const struct stat *st, unsigned int variant)
+{
+	int i;
+	uint32_t key[5];
+	unsigned char *kptr = (unsigned char*)key;
+	static char *buf;
+	static int bufsz;
+	uint32_t hash_hi = 0xcbf29ce4, hash_lo = 0x84222325;
+	int len = strlen(cachedir) + 32;
+
+	if(len > bufsz) {
+		free(buf);
+		if(!(buf = malloc(len))) {
+			perror("imgcache: failed to allocate path buffer");
+			abort();
+		}
+		bufsz = len;
+	}
+
+	key[0] = (uint64_t)st->st_dev >> 32;
+	key[1] = st->st_dev & 0xffffffff;
+	key[2] = (uint64_t)st->st_ino >> 32;
+	key[3] = st->st_ino & 0xffffffff;
+	key[4] = variant;
+
+	for(i=0; i<sizeof key; i++) {
+		uint64_t h = ((uint64_t)hash_hi << 32 | hash_lo) ^ kptr[i];
+		h *= 0x100000001b3;
+		hash_hi = h >> 32;
+		hash_lo = h & 0xffffffff;
+	}
+
+	sprintf(buf, "%s/%08x%08x" CACHE_SUFFIX, cachedir, hash_hi, hash_lo);
+	return buf;
+}
+
+struct cache_file {
+	char *name;
+	long size;
+	time_t mtime;
+};
+
+static int cmp_mtime(const void *a, const void *b)
+{
+	const struct cache_file *fa = a;
+	const struct cache_file *fb = b;
+	return fa->mtime < fb->mtime ? -1 : (fa->mtime > fb->mtime ? 1 : 0);
+}
+
+/* removes the least recently used cache entries while the total size of the
+ * cache is above cfg.disk_cache_size
+ */
+static void prune_cache(void)
+{
+	DIR *dir;
+	struct dirent *dent;
+	struct stat st;
+	struct cache_file *files = 0, *tmp;
+	int i, num_files = 0, max_files = 0;
+	unsigned long total = 0, limit = (unsigned long)cfg.disk_cache_size << 20;
+	char *path = alloca(strlen(cachedir) + 256 + 2);
+	int suffix_len = strlen(CACHE_SUFFIX);
+
+	if(!(dir = opendir(cachedir))) {
+		return;
+	}
+	while((dent = readdir(dir))) {
+		int len = strlen(dent->d_name);
+		if(len <= suffix_len || strcmp(dent->d_name + len - suffix_len, CACHE_SUFFIX) != 0) {
+			continue;
+		}
+		sprintf(path, "%s/%s", cachedir, dent->d_name);
+		if(stat(path, &st) == -1) continue;
+
+		if(num_files >= max_files) {
+			int nmax = max_files ? max_files * 2 : 16;
+			if(!(tmp = realloc(files, nmax * sizeof *files))) {
+				break;
+			}
+			files = tmp;
+			max_files = nmax;
+		}
+		if(!(files[num_files].name = strdup(dent->d_name))) {
+			break;
+		}
+		files[num_files].size = st.st_size;
+		files[num_files].mtime = st.st_mtime;
+		total += st.st_size;
+		num_files++;
+	}
+	closedir(dir);
+
+	if(total > limit) {
+		qsort(files, num_files, sizeof *files, cmp_mtime);
+		for(i=0; i<num_files && total > limit; i++) {
+			sprintf(path, "%s/%s", cachedir, files[i].name);
+			if(remove(path) != -1) {
+				total -= files[i].size;
+			}
+		}
+	}
+
+	for(i=0; i<num_files; i++) {
+		free(files[i].name);
+	}
+	free(files);
+}
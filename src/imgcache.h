@@ -0,0 +1,58 @@
+/*
+xlivebg - live wallpapers for the X window system
+Copyright (C) 2019-2020  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef IMGCACHE_H_
+#define IMGCACHE_H_
+
+#include "xlivebg.h"
+
+/* Persistent cache of decoded images.
+ * Decoded RGBA pixels are stored in the cache directory ($XDG_CACHE_HOME/xlivebg
+ * or ~/.cache/xlivebg), keyed by the identity of the source image file, and
+ * validated against its size and modification time. Cached images are mmap'ed
+ * on load, so no decoding or copying takes place. Images may be stored
+ * downscaled, in which case the size of the original is kept alongside, to let
+ * the caller decide if the cached resolution is still adequate.
+ *
+ * If cfg.shared_cache is set, that directory is used instead, and shared by all
+ * instances on the host (typically on a tmpfs like /dev/shm). Entries are then
+ * mapped read-only and shared, so instances showing the same image reference a
+ * single copy of its pixels, instead of decoding their own. Entries are only
+ * used if they belong to the current user, or to cfg.shared_cache_owner.
+ */
+
+int imgcache_init(void);
+
+/* tries to load the cached pixels of fname into img. On success img->pixels
+ * points into a file mapping, which must be released with imgcache_unmap, and
+ * must not be written to. Returns -1 if there's no valid cache entry.
+ * variant allows keeping multiple copies of the same image (0 for the default).
+ */
+int imgcache_load(struct xlivebg_image *img, const char *fname, unsigned int variant,
+		int *src_width, int *src_height);
+/* writes the pixels of img to the cache, as the decoded image of fname */
+int imgcache_store(struct xlivebg_image *img, const char *fname, unsigned int variant,
+		int src_width, int src_height);
+
+/* returns non-zero if pixels points to a mapped cache entry */
+int imgcache_ismapped(void *pixels);
+/* returns non-zero if pixels points to a read-only mapping of a shared entry */
+int imgcache_isreadonly(void *pixels);
+/* unmaps pixels if it's a mapped cache entry and returns 0, otherwise -1 */
+int imgcache_unmap(void *pixels);
+
+#endif	/* IMGCACHE_H_ */
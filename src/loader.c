@@ -0,0 +1,192 @@
+/*
+xlivebg - live wallpapers for the X window system
+Copyright (C) 2019-2020  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include "loader.h"
+
+struct job {
+	void (*work)(void*);
+	void (*done)(void*);
+	void *data;
+	struct job *next;
+};
+
+struct job_queue {
+	struct job *head, *tail;
+};
+
+static void *thread_func(void *arg);
+static void enqueue(struct job_queue *q, struct job *job);
+static struct job *dequeue(struct job_queue *q);
+
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+static struct job_queue pending, finished;
+static int quit, running;
+static int pfd[2] = {-1, -1};
+
+
+int loader_init(void)
+{
+	if(running) {
+		fprintf(stderr, "loader_init: already initialized!\n");
+		return -1;
+	}
+
+	if(pipe(pfd) == -1) {
+		fprintf(stderr, "loader_init: failed to create pipe: %s\n", strerror(errno));
+		return -1;
+	}
+	fcntl(pfd[0], F_SETFL, fcntl(pfd[0], F_GETFL) | O_NONBLOCK);
+
+	quit = 0;
+	if(pthread_create(&thread, 0, thread_func, 0) != 0) {
+		fprintf(stderr, "loader_init: failed to create worker thread\n");
+		close(pfd[0]);
+		close(pfd[1]);
+		pfd[0] = pfd[1] = -1;
+		return -1;
+	}
+	running = 1;
+	return 0;
+}
+
+void loader_shutdown(void)
+{
+	struct job *job;
+
+	if(!running) return;
+
+	pthread_mutex_lock(&lock);
+	quit = 1;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, 0);
+	running = 0;
+
+	/* jobs which never ran, or never got their completion callback, are
+	 * dropped. Their data is leaked, as we're shutting down anyway.
+	 */
+	while((job = dequeue(&pending))) free(job);
+	while((job = dequeue(&finished))) free(job);
+
+	close(pfd[0]);
+	close(pfd[1]);
+	pfd[0] = pfd[1] = -1;
+}
+
+int loader_fd(void)
+{
+	return pfd[0];
+}
+
+int loader_submit(void (*work)(void*), void (*done)(void*), void *data)
+{
+	struct job *job;
+
+	if(!running) {
+		/* no worker thread, do it synchronously */
+		work(data);
+		if(done) done(data);
+		return 0;
+	}
+
+	if(!(job = malloc(sizeof *job))) {
+		perror("loader_submit: failed to allocate job");
+		return -1;
+	}
+	job->work = work;
+	job->done = done;
+	job->data = data;
+
+	pthread_mutex_lock(&lock);
+	enqueue(&pending, job);
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+void loader_process(void)
+{
+	struct job *job;
+	char buf[64];
+
+	while(read(pfd[0], buf, sizeof buf) > 0);
+
+	for(;;) {
+		pthread_mutex_lock(&lock);
+		job = dequeue(&finished);
+		pthread_mutex_unlock(&lock);
+		if(!job) break;
+
+		if(job->done) {
+			job->done(job->data);
+		}
+		free(job);
+	}
+}
+
+static void *thread_func(void *arg)
+{
+	struct job *job;
+
+	pthread_mutex_lock(&lock);
+	while(!quit) {
+		if(!(job = dequeue(&pending))) {
+			pthread_cond_wait(&cond, &lock);
+			continue;
+		}
+		pthread_mutex_unlock(&lock);
+
+		job->work(job->data);
+
+		pthread_mutex_lock(&lock);
+		enqueue(&finished, job);
+		write(pfd[1], "", 1);
+	}
+	pthread_mutex_unlock(&lock);
+	return 0;
+}
+
+static void enqueue(struct job_queue *q, struct job *job)
+{
+	job->next = 0;
+	if(q->tail) {
+		q->tail->next = job;
+	} else {
+		q->head = job;
+	}
+	q->tail = job;
+}
+
+static struct job *dequeue(struct job_queue *q)
+{
+	struct job *job = q->head;
+	if(job) {
+		if(!(q->head = job->next)) {
+			q->tail = 0;
+		}
+	}
+	return job;
+}
@@ -0,0 +1,40 @@
+/*
+xlivebg - live wallpapers for the X window system
+Copyright (C) 2019-2020  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef LOADER_H_
+#define LOADER_H_
+
+/* Background job queue, used for decoding images without stalling rendering.
+ * Jobs run in order on a worker thread. Their completion callbacks are called
+ * from the main thread by loader_process, when loader_fd becomes readable.
+ */
+
+int loader_init(void);
+void loader_shutdown(void);
+
+/* returns the file descriptor which becomes readable when jobs complete */
+int loader_fd(void);
+
+/* work is called on the worker thread, then done (if not null) is called on the
+ * main thread, by loader_process. Both are passed data.
+ */
+int loader_submit(void (*work)(void*), void (*done)(void*), void *data);
+
+/* calls the completion callbacks of all finished jobs */
+void loader_process(void);
+
+#endif	/* LOADER_H_ */
@@ -36,6 +36,14 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "cfg.h"
 #include "ctrl.h"
 #include "imageman.h"
+#include "loader.h"
+#include "filewatch.h"
+#include "slideshow.h"
+
+/* frame interval (usec) used while streaming textures, if the active plugin
+ * doesn't request frequent updates
+ */
+#define UPLOAD_FRAME_INTERVAL	16667
 
 /* create_xwindow flags */
 enum {
@@ -166,7 +174,12 @@ int main(int argc, char **argv)
 		printf("output: %dx%d\n", scr_width, scr_height);
 	}
 
+	loader_init();
+	fwatch_init();
+
 	if(app_init(argc, argv) == -1) {
+		fwatch_shutdown();
+		loader_shutdown();
 		ctrl_shutdown();
 		XCloseDisplay(dpy);
 		return 1;
@@ -177,8 +190,8 @@ int main(int argc, char **argv)
 	while(!quit) {
 		fd_set rdset;
 		struct timeval *timeout;
-		int i, max_fd, num_ctrl_sock;
-		long interval;
+		int i, max_fd, num_ctrl_sock, ldfd, fwfd;
+		long interval, ss_timeout;
 		int *ctrl_sock;
 
 		while(XPending(dpy)) {
@@ -212,8 +225,24 @@ int main(int argc, char **argv)
 			FD_SET(s, &rdset);
 			if(s > max_fd) max_fd = s;
 		}
+		if((ldfd = loader_fd()) >= 0) {
+			FD_SET(ldfd, &rdset);
+			if(ldfd > max_fd) max_fd = ldfd;
+		}
+		if((fwfd = fwatch_fd()) >= 0) {
+			FD_SET(fwfd, &rdset);
+			if(fwfd > max_fd) max_fd = fwfd;
+		}
 
 		interval = (cfg.fps_override > 0) ? cfg.fps_override_interval : upd_interval_usec;
+		/* keep drawing frames while a texture upload or crossfade is in progress */
+		if(image_upload_pending() && (interval <= 0 || interval > UPLOAD_FRAME_INTERVAL)) {
+			interval = UPLOAD_FRAME_INTERVAL;
+		}
+		/* wake up in time for the next slideshow slide */
+		if((ss_timeout = slideshow_timeout()) >= 0 && (interval <= 0 || interval > ss_timeout)) {
+			interval = ss_timeout > 0 ? ss_timeout : 1;
+		}
 
 		if(interval > 0) {
 			struct timeval now;
@@ -233,17 +262,25 @@ int main(int argc, char **argv)
 
 		if(select(max_fd + 1, &rdset, 0, 0, timeout) > 0) {
 			/* ignore X events, we'll just handle those at the top of the loop
-			 * shortly. just handle control socket input
+			 * shortly. just handle control socket input, and image reloading
 			 */
 			for(i=0; i<num_ctrl_sock; i++) {
 				if(FD_ISSET(ctrl_sock[i], &rdset)) {
 					ctrl_process(ctrl_sock[i]);
 				}
 			}
+			if(fwfd >= 0 && FD_ISSET(fwfd, &rdset)) {
+				fwatch_process();
+			}
+			if(ldfd >= 0 && FD_ISSET(ldfd, &rdset)) {
+				loader_process();
+			}
 		}
 	}
 
 done:
+	fwatch_shutdown();
+	loader_shutdown();
 	ctrl_shutdown();
 	send_expose(win);
 	if(visinf) {
@@ -491,6 +528,7 @@ static int proc_xevent(XEvent *ev)
 				printf("Video outputs changed, reconfiguring\n");
 				XRRUpdateConfiguration(ev);
 				detect_outputs();
+				update_image_sizes();
 			}
 		}
 #endif
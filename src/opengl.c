@@ -1,12 +1,29 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "opengl.h"
 #include <GL/glx.h>
 
 #define GETGLFUNC(name) glXGetProcAddress((unsigned char*)name)
 
+static int have_extension(const char *name);
+
 GLUSEPROGRAMFUNC xlivebg_gl_use_program;
 GLBINDBUFFERFUNC xlivebg_gl_bind_buffer;
+GLGENBUFFERSFUNC xlivebg_gl_gen_buffers;
+GLDELETEBUFFERSFUNC xlivebg_gl_delete_buffers;
+GLBUFFERDATAFUNC xlivebg_gl_buffer_data;
+GLMAPBUFFERFUNC xlivebg_gl_map_buffer;
+GLUNMAPBUFFERFUNC xlivebg_gl_unmap_buffer;
+GLGENERATEMIPMAPFUNC xlivebg_gl_generate_mipmap;
+GLGENFRAMEBUFFERSFUNC xlivebg_gl_gen_framebuffers;
+GLDELETEFRAMEBUFFERSFUNC xlivebg_gl_delete_framebuffers;
+GLBINDFRAMEBUFFERFUNC xlivebg_gl_bind_framebuffer;
+GLFRAMEBUFFERTEXTURE2DFUNC xlivebg_gl_framebuffer_texture2d;
+GLCHECKFRAMEBUFFERSTATUSFUNC xlivebg_gl_check_framebuffer_status;
+
+int xlivebg_have_pbo;
+int xlivebg_have_fbo;
 
 int init_opengl(void)
 {
@@ -16,6 +33,68 @@ int init_opengl(void)
 	if(!(xlivebg_gl_bind_buffer = (GLBINDBUFFERFUNC)GETGLFUNC("glBindBuffer"))) {
 		xlivebg_gl_bind_buffer = (GLBINDBUFFERFUNC)GETGLFUNC("glBindBufferARB");
 	}
+	if(!(xlivebg_gl_gen_buffers = (GLGENBUFFERSFUNC)GETGLFUNC("glGenBuffers"))) {
+		xlivebg_gl_gen_buffers = (GLGENBUFFERSFUNC)GETGLFUNC("glGenBuffersARB");
+	}
+	if(!(xlivebg_gl_delete_buffers = (GLDELETEBUFFERSFUNC)GETGLFUNC("glDeleteBuffers"))) {
+		xlivebg_gl_delete_buffers = (GLDELETEBUFFERSFUNC)GETGLFUNC("glDeleteBuffersARB");
+	}
+	if(!(xlivebg_gl_buffer_data = (GLBUFFERDATAFUNC)GETGLFUNC("glBufferData"))) {
+		xlivebg_gl_buffer_data = (GLBUFFERDATAFUNC)GETGLFUNC("glBufferDataARB");
+	}
+	if(!(xlivebg_gl_map_buffer = (GLMAPBUFFERFUNC)GETGLFUNC("glMapBuffer"))) {
+		xlivebg_gl_map_buffer = (GLMAPBUFFERFUNC)GETGLFUNC("glMapBufferARB");
+	}
+	if(!(xlivebg_gl_unmap_buffer = (GLUNMAPBUFFERFUNC)GETGLFUNC("glUnmapBuffer"))) {
+		xlivebg_gl_unmap_buffer = (GLUNMAPBUFFERFUNC)GETGLFUNC("glUnmapBufferARB");
+	}
+	if(!(xlivebg_gl_generate_mipmap = (GLGENERATEMIPMAPFUNC)GETGLFUNC("glGenerateMipmap"))) {
+		xlivebg_gl_generate_mipmap = (GLGENERATEMIPMAPFUNC)GETGLFUNC("glGenerateMipmapEXT");
+	}
+	if(!(xlivebg_gl_gen_framebuffers = (GLGENFRAMEBUFFERSFUNC)GETGLFUNC("glGenFramebuffers"))) {
+		xlivebg_gl_gen_framebuffers = (GLGENFRAMEBUFFERSFUNC)GETGLFUNC("glGenFramebuffersEXT");
+	}
+	if(!(xlivebg_gl_delete_framebuffers = (GLDELETEFRAMEBUFFERSFUNC)GETGLFUNC("glDeleteFramebuffers"))) {
+		xlivebg_gl_delete_framebuffers = (GLDELETEFRAMEBUFFERSFUNC)GETGLFUNC("glDeleteFramebuffersEXT");
+	}
+	if(!(xlivebg_gl_bind_framebuffer = (GLBINDFRAMEBUFFERFUNC)GETGLFUNC("glBindFramebuffer"))) {
+		xlivebg_gl_bind_framebuffer = (GLBINDFRAMEBUFFERFUNC)GETGLFUNC("glBindFramebufferEXT");
+	}
+	if(!(xlivebg_gl_framebuffer_texture2d = (GLFRAMEBUFFERTEXTURE2DFUNC)GETGLFUNC("glFramebufferTexture2D"))) {
+		xlivebg_gl_framebuffer_texture2d = (GLFRAMEBUFFERTEXTURE2DFUNC)GETGLFUNC("glFramebufferTexture2DEXT");
+	}
+	if(!(xlivebg_gl_check_framebuffer_status = (GLCHECKFRAMEBUFFERSTATUSFUNC)GETGLFUNC("glCheckFramebufferStatus"))) {
+		xlivebg_gl_check_framebuffer_status = (GLCHECKFRAMEBUFFERSTATUSFUNC)GETGLFUNC("glCheckFramebufferStatusEXT");
+	}
+
+	/* glXGetProcAddress may return non-null even for unsupported functions,
+	 * so also check the extension string
+	 */
+	xlivebg_have_pbo = xlivebg_gl_gen_buffers && xlivebg_gl_delete_buffers &&
+		xlivebg_gl_bind_buffer && xlivebg_gl_buffer_data && xlivebg_gl_map_buffer &&
+		xlivebg_gl_unmap_buffer && have_extension("GL_ARB_pixel_buffer_object");
+	if(!have_extension("GL_ARB_framebuffer_object") && !have_extension("GL_EXT_framebuffer_object")) {
+		xlivebg_gl_generate_mipmap = 0;
+	} else {
+		xlivebg_have_fbo = xlivebg_gl_gen_framebuffers && xlivebg_gl_delete_framebuffers &&
+			xlivebg_gl_bind_framebuffer && xlivebg_gl_framebuffer_texture2d &&
+			xlivebg_gl_check_framebuffer_status;
+	}
+	return 0;
+}
+
+static int have_extension(const char *name)
+{
+	int len = strlen(name);
+	const char *ptr, *ext, *extstr = (const char*)glGetString(GL_EXTENSIONS);
+
+	if(!(ext = extstr)) return 0;
+	while((ptr = strstr(ext, name))) {
+		if((ptr == extstr || ptr[-1] == ' ') && (ptr[len] == ' ' || ptr[len] == 0)) {
+			return 1;
+		}
+		ext = ptr + len;
+	}
 	return 0;
 }
 
@@ -9,12 +9,57 @@
 #ifndef GL_ARRAY_BUFFER
 #define GL_ARRAY_BUFFER foo
 #endif
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER	0x88ec
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW			0x88e0
+#endif
+#ifndef GL_WRITE_ONLY
+#define GL_WRITE_ONLY			0x88b9
+#endif
+#ifndef GL_FRAMEBUFFER
+#define GL_FRAMEBUFFER			0x8d40
+#endif
+#ifndef GL_COLOR_ATTACHMENT0
+#define GL_COLOR_ATTACHMENT0	0x8ce0
+#endif
+#ifndef GL_FRAMEBUFFER_COMPLETE
+#define GL_FRAMEBUFFER_COMPLETE	0x8cd5
+#endif
 
 typedef void (*GLUSEPROGRAMFUNC)(unsigned int);
 typedef void (*GLBINDBUFFERFUNC)(unsigned int, unsigned int);
+typedef void (*GLGENBUFFERSFUNC)(int, unsigned int*);
+typedef void (*GLDELETEBUFFERSFUNC)(int, const unsigned int*);
+typedef void (*GLBUFFERDATAFUNC)(unsigned int, long, const void*, unsigned int);
+typedef void *(*GLMAPBUFFERFUNC)(unsigned int, unsigned int);
+typedef unsigned char (*GLUNMAPBUFFERFUNC)(unsigned int);
+typedef void (*GLGENERATEMIPMAPFUNC)(unsigned int);
+typedef void (*GLGENFRAMEBUFFERSFUNC)(int, unsigned int*);
+typedef void (*GLDELETEFRAMEBUFFERSFUNC)(int, const unsigned int*);
+typedef void (*GLBINDFRAMEBUFFERFUNC)(unsigned int, unsigned int);
+typedef void (*GLFRAMEBUFFERTEXTURE2DFUNC)(unsigned int, unsigned int, unsigned int, unsigned int, int);
+typedef unsigned int (*GLCHECKFRAMEBUFFERSTATUSFUNC)(unsigned int);
 
 extern GLUSEPROGRAMFUNC xlivebg_gl_use_program;
 extern GLBINDBUFFERFUNC xlivebg_gl_bind_buffer;
+extern GLGENBUFFERSFUNC xlivebg_gl_gen_buffers;
+extern GLDELETEBUFFERSFUNC xlivebg_gl_delete_buffers;
+extern GLBUFFERDATAFUNC xlivebg_gl_buffer_data;
+extern GLMAPBUFFERFUNC xlivebg_gl_map_buffer;
+extern GLUNMAPBUFFERFUNC xlivebg_gl_unmap_buffer;
+extern GLGENERATEMIPMAPFUNC xlivebg_gl_generate_mipmap;
+extern GLGENFRAMEBUFFERSFUNC xlivebg_gl_gen_framebuffers;
+extern GLDELETEFRAMEBUFFERSFUNC xlivebg_gl_delete_framebuffers;
+extern GLBINDFRAMEBUFFERFUNC xlivebg_gl_bind_framebuffer;
+extern GLFRAMEBUFFERTEXTURE2DFUNC xlivebg_gl_framebuffer_texture2d;
+extern GLCHECKFRAMEBUFFERSTATUSFUNC xlivebg_gl_check_framebuffer_status;
+
+/* non-zero if pixel buffer objects are supported */
+extern int xlivebg_have_pbo;
+/* non-zero if framebuffer objects are supported */
+extern int xlivebg_have_fbo;
 
 int init_opengl(void);
 
@@ -30,6 +30,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "xlivebg.h"
 #include "app.h"
 #include "imageman.h"
+#include "plugin.h"
 #include "util.h"
 #include "cfg.h"
 #include "treestore.h"
@@ -260,23 +261,30 @@ unsigned int xlivebg_image_texture(struct xlivebg_image *img)
 	return img->tex;
 }
 
+uint32_t *xlivebg_image_pixels(struct xlivebg_image *img)
+{
+	return get_image_pixels(img);
+}
+
 int xlivebg_fit_mode(int scr)
 {
-	/* TODO per-screen */
-	return cfg.fit;
+	struct cfg_screen *sc = cfg_screen(scr);
+	return sc && sc->fit >= 0 ? sc->fit : cfg.fit;
 }
 
 float xlivebg_crop_zoom(int scr)
 {
-	/* TODO per-screen */
-	return cfg.zoom;
+	struct cfg_screen *sc = cfg_screen(scr);
+	return sc && sc->zoom >= 0.0f ? sc->zoom : cfg.zoom;
 }
 
 void xlivebg_crop_dir(int scr, float *dirvec)
 {
-	/* TODO per-screen */
-	dirvec[0] = cfg.crop_dir[0];
-	dirvec[1] = cfg.crop_dir[1];
+	struct cfg_screen *sc = cfg_screen(scr);
+	float *dir = sc && sc->have_crop_dir ? sc->crop_dir : cfg.crop_dir;
+
+	dirvec[0] = dir[0];
+	dirvec[1] = dir[1];
 }
 
 /* plugin configuration interface */
@@ -547,12 +555,21 @@ void xlivebg_clear(unsigned int mask)
 }
 
 void xlivebg_calc_image_proj(int sidx, float img_aspect, float *xform)
+{
+	float cdir[2];
+	struct xlivebg_screen *scr = xlivebg_screen(sidx);
+
+	xlivebg_crop_dir(sidx, cdir);
+	calc_image_proj(scr->width, scr->height, xlivebg_fit_mode(sidx), xlivebg_crop_zoom(sidx),
+			cdir, img_aspect, xform);
+}
+
+void calc_image_proj(int scr_width, int scr_height, int fit_mode, float zoom,
+		const float *cdir, float img_aspect, float *xform)
 {
 	static const float ident[] = {1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1};
 	float vpscale;
-	struct xlivebg_screen *scr = xlivebg_screen(sidx);
-	float aspect = (float)scr->width / (float)scr->height;
-	int fit_mode = xlivebg_fit_mode(sidx);
+	float aspect = (float)scr_width / (float)scr_height;
 
 	memcpy(xform, ident, sizeof ident);
 
@@ -567,16 +584,14 @@ void xlivebg_calc_image_proj(int sidx, float img_aspect, float *xform)
 
 		if(fit_mode == XLIVEBG_FIT_CROP) {
 			float cropscale, maxpan, tx, ty;
-			float cdir[2];
 
 			cropscale = 1.0f / vpscale;
-			cropscale = 1.0f + (cropscale - 1.0f) * xlivebg_crop_zoom(sidx);
+			cropscale = 1.0f + (cropscale - 1.0f) * zoom;
 			maxpan = cropscale - 1.0f;
 
 			xform[0] *= cropscale;
 			xform[5] *= cropscale;
 
-			xlivebg_crop_dir(sidx, cdir);
 			if(aspect > img_aspect) {
 				tx = 0.0f;
 				ty = -cdir[1] * maxpan;
@@ -624,31 +639,19 @@ static int update_builtin_cfg(const char *cfgpath, struct ts_value *tsval)
 		return 1;
 	}
 	if(strcmp(cfgpath, CFGNAME_IMAGE) == 0 || strcmp(cfgpath, CFGNAME_ANIM_MASK) == 0) {
-		struct xlivebg_image *img = 0;
 		const char *fname = 0;
 		if(tsval && tsval->str && *tsval->str) {
-			int idx = find_image(tsval->str);
-			if(idx >= 0) {
-				img = get_image(idx);
-			} else {
-				if(!(img = malloc(sizeof *img)) || load_image(img, tsval->str) == -1) {
-					fprintf(stderr, "update_builtin_cfg(%s<-%s): failed to load image\n", cfgpath, tsval->str);
-					free(img);
-					return 1;
-				}
-				add_image(img);
-			}
 			fname = tsval->str;
 		}
 		if(strcmp(cfgpath, CFGNAME_IMAGE) == 0) {
 			free(cfg.image);
 			cfg.image = fname ? strdup(fname) : 0;
-			set_bg_image(0, img);
 		} else {
 			free(cfg.anm_mask);
 			cfg.anm_mask = fname ? strdup(fname) : 0;
-			set_anim_mask(0, img);
 		}
+		/* reassign images on all outputs which don't override this setting */
+		update_screen_images();
 		return 1;
 	}
 	if(strcmp(cfgpath, CFGNAME_COLOR) == 0) {
@@ -688,10 +691,12 @@ static int update_builtin_cfg(const char *cfgpath, struct ts_value *tsval)
 	}
 	if(strcmp(cfgpath, CFGNAME_FIT) == 0) {
 		cfg.fit = tsval ? cfg_parse_fit(tsval->str) : 0;
+		update_image_sizes();
 		return 1;
 	}
 	if(strcmp(cfgpath, CFGNAME_CROP_ZOOM) == 0) {
 		cfg.zoom = tsval ? tsval->fnum : 1;
+		update_image_sizes();
 		return 1;
 	}
 	if(strcmp(cfgpath, CFGNAME_CROP_DIR) == 0) {
@@ -703,6 +708,50 @@ static int update_builtin_cfg(const char *cfgpath, struct ts_value *tsval)
 		}
 		return 1;
 	}
+	if(strcmp(cfgpath, CFGNAME_CACHE_RAM) == 0) {
+		cfg.cache_ram = tsval ? tsval->inum : DEF_CACHE_RAM;
+		trim_image_cache();
+		return 1;
+	}
+	if(strcmp(cfgpath, CFGNAME_CACHE_VRAM) == 0) {
+		cfg.cache_vram = tsval ? tsval->inum : DEF_CACHE_VRAM;
+		trim_image_cache();
+		return 1;
+	}
+	if(strcmp(cfgpath, CFGNAME_DISK_CACHE) == 0) {
+		cfg.disk_cache = tsval ? tsval->inum : 1;
+		return 1;
+	}
+	if(strcmp(cfgpath, CFGNAME_DISK_CACHE_SIZE) == 0) {
+		cfg.disk_cache_size = tsval ? tsval->inum : DEF_DISK_CACHE_SIZE;
+		return 1;
+	}
+	if(strcmp(cfgpath, CFGNAME_SLIDESHOW_INTERVAL) == 0) {
+		cfg.slideshow_interval = tsval ? tsval->inum : DEF_SLIDESHOW_INTERVAL;
+		return 1;
+	}
+	if(strcmp(cfgpath, CFGNAME_XFADE_TIME) == 0) {
+		cfg.xfade_time = tsval ? tsval->fnum : DEF_XFADE_TIME;
+		return 1;
+	}
+	if(strcmp(cfgpath, CFGNAME_COMPACT_TEX) == 0) {
+		cfg.compact_tex = tsval ? tsval->inum : 0;
+		return 1;
+	}
+	if(strcmp(cfgpath, CFGNAME_PREVIEW) == 0) {
+		cfg.preview = tsval ? tsval->inum : 1;
+		return 1;
+	}
+	if(strcmp(cfgpath, CFGNAME_HDR_TONEMAP) == 0) {
+		cfg.hdr_tonemap = tsval ? cfg_parse_tonemap(tsval->str) : 0;
+		reload_images();
+		return 1;
+	}
+	if(strcmp(cfgpath, CFGNAME_HDR_EXPOSURE) == 0) {
+		cfg.hdr_exposure = tsval ? tsval->fnum : 1;
+		reload_images();
+		return 1;
+	}
 
 	return 0;
 }
@@ -784,6 +833,12 @@ static float *get_builtin_num(const char *cfgpath)
 	if(strcmp(cfgpath, CFGNAME_CROP_ZOOM) == 0) {
 		return &cfg.zoom;
 	}
+	if(strcmp(cfgpath, CFGNAME_XFADE_TIME) == 0) {
+		return &cfg.xfade_time;
+	}
+	if(strcmp(cfgpath, CFGNAME_HDR_EXPOSURE) == 0) {
+		return &cfg.hdr_exposure;
+	}
 	return 0;
 }
 
@@ -798,6 +853,30 @@ static int *get_builtin_int(const char *cfgpath)
 	if(strcmp(cfgpath, CFGNAME_BGMODE) == 0) {
 		return &cfg.bgmode;
 	}
+	if(strcmp(cfgpath, CFGNAME_CACHE_RAM) == 0) {
+		return &cfg.cache_ram;
+	}
+	if(strcmp(cfgpath, CFGNAME_CACHE_VRAM) == 0) {
+		return &cfg.cache_vram;
+	}
+	if(strcmp(cfgpath, CFGNAME_DISK_CACHE) == 0) {
+		return &cfg.disk_cache;
+	}
+	if(strcmp(cfgpath, CFGNAME_DISK_CACHE_SIZE) == 0) {
+		return &cfg.disk_cache_size;
+	}
+	if(strcmp(cfgpath, CFGNAME_SLIDESHOW_INTERVAL) == 0) {
+		return &cfg.slideshow_interval;
+	}
+	if(strcmp(cfgpath, CFGNAME_COMPACT_TEX) == 0) {
+		return &cfg.compact_tex;
+	}
+	if(strcmp(cfgpath, CFGNAME_PREVIEW) == 0) {
+		return &cfg.preview;
+	}
+	if(strcmp(cfgpath, CFGNAME_HDR_TONEMAP) == 0) {
+		return &cfg.hdr_tonemap;
+	}
 	return 0;
 }
 
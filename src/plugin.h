@@ -35,4 +35,8 @@ struct xlivebg_plugin *get_active_plugin(void);
 
 int remove_plugin(int idx);
 
+/* the image projection of xlivebg_calc_image_proj, for explicit output parameters */
+void calc_image_proj(int scr_width, int scr_height, int fit_mode, float zoom,
+		const float *crop_dir, float img_aspect, float *xform);
+
 #endif	/* PLUGIN_H_ */
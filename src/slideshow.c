@@ -0,0 +1,226 @@
+/*
+xlivebg - live wallpapers for the X window system
+Copyright (C) 2019-2020  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "slideshow.h"
+#include "imageman.h"
+#include "app.h"
+#include "cfg.h"
+
+enum { SS_IDLE, SS_LOADING, SS_READY };
+
+struct slideshow {
+	char *dir;
+	char **files;
+	int num_files, cur;
+	int next_slide;				/* slide being prefetched or ready to be shown */
+	int state;
+	unsigned long switch_time;	/* when to show the next slide (msec) */
+	struct slideshow *next;
+};
+
+static struct slideshow *find_slideshow(const char *path);
+static struct slideshow *create_slideshow(const char *path);
+static unsigned int slideshow_screens(struct slideshow *ss);
+static void prefetch_done(int res, void *cls);
+
+/* slideshows are never destroyed, their prefetch callbacks may be pending */
+static struct slideshow *sslist;
+
+
+const char *slideshow_image(const char *path)
+{
+	struct slideshow *ss;
+	struct stat st;
+
+	if(!path || !*path) return path;
+
+	if(!(ss = find_slideshow(path))) {
+		if(stat(path, &st) == -1 || !S_ISDIR(st.st_mode)) {
+			return path;
+		}
+		if(!(ss = create_slideshow(path))) {
+			return path;
+		}
+	}
+	return ss->files[ss->cur];
+}
+
+void slideshow_update(void)
+{
+	struct slideshow *ss = sslist;
+	unsigned int scrmask;
+
+	while(ss) {
+		if(ss->num_files > 1 && (scrmask = slideshow_screens(ss))) {
+			if(ss->state == SS_IDLE) {
+				ss->next_slide = (ss->cur + 1) % ss->num_files;
+				ss->state = SS_LOADING;
+				prefetch_image(ss->files[ss->next_slide], scrmask, prefetch_done, ss);
+			}
+
+			/* if the next slide isn't ready in time, keep showing this one */
+			if(ss->state == SS_READY && (long)(msec - ss->switch_time) >= 0) {
+				ss->cur = ss->next_slide;
+				ss->state = SS_IDLE;
+				ss->switch_time = msec + cfg.slideshow_interval * 1000;
+				update_screen_images();
+			}
+		}
+		ss = ss->next;
+	}
+}
+
+long slideshow_timeout(void)
+{
+	long dt, timeout = -1;
+	struct slideshow *ss = sslist;
+
+	while(ss) {
+		if(ss->state == SS_READY && slideshow_screens(ss)) {
+			dt = (long)(ss->switch_time - msec);
+			if(dt < 0) dt = 0;
+			if(timeout < 0 || dt * 1000 < timeout) {
+				timeout = dt * 1000;
+			}
+		}
+		ss = ss->next;
+	}
+	return timeout;
+}
+
+static struct slideshow *find_slideshow(const char *path)
+{
+	struct slideshow *ss = sslist;
+
+	while(ss) {
+		if(strcmp(ss->dir, path) == 0) {
+			return ss;
+		}
+		ss = ss->next;
+	}
+	return 0;
+}
+
+static int cmp_names(const void *a, const void *b)
+{
+	return strcmp(*(char**)a, *(char**)b);
+}
+
+static struct slideshow *create_slideshow(const char *path)
+{
+	DIR *dir;
+	struct dirent *dent;
+	struct stat st;
+	struct slideshow *ss;
+	char *fname, **tmp;
+	int max_files = 0;
+
+	if(!(dir = opendir(path))) {
+		fprintf(stderr, "slideshow: failed to open directory: %s: %s\n", path, strerror(errno));
+		return 0;
+	}
+	if(!(ss = calloc(1, sizeof *ss)) || !(ss->dir = strdup(path))) {
+		free(ss);
+		closedir(dir);
+		return 0;
+	}
+
+	while((dent = readdir(dir))) {
+		if(dent->d_name[0] == '.') continue;
+
+		if(!(fname = malloc(strlen(path) + strlen(dent->d_name) + 2))) {
+			break;
+		}
+		sprintf(fname, "%s/%s", path, dent->d_name);
+		if(stat(fname, &st) == -1 || !S_ISREG(st.st_mode)) {
+			free(fname);
+			continue;
+		}
+
+		if(ss->num_files >= max_files) {
+			int nmax = max_files ? max_files * 2 : 16;
+			if(!(tmp = realloc(ss->files, nmax * sizeof *ss->files))) {
+				free(fname);
+				break;
+			}
+			ss->files = tmp;
+			max_files = nmax;
+		}
+		ss->files[ss->num_files++] = fname;
+	}
+	closedir(dir);
+
+	if(!ss->num_files) {
+		fprintf(stderr, "slideshow: no images found in %s\n", path);
+		free(ss->files);
+		free(ss->dir);
+		free(ss);
+		return 0;
+	}
+	qsort(ss->files, ss->num_files, sizeof *ss->files, cmp_names);
+
+	ss->state = SS_IDLE;
+	ss->switch_time = msec + cfg.slideshow_interval * 1000;
+	ss->next = sslist;
+	sslist = ss;
+
+	printf("slideshow: %d images in %s\n", ss->num_files, path);
+	return ss;
+}
+
+/* returns a bitmask of the outputs showing this slideshow */
+static unsigned int slideshow_screens(struct slideshow *ss)
+{
+	int i;
+	const char *path;
+	unsigned int mask = 0;
+
+	for(i=0; i<num_screens; i++) {
+		if((path = cfg_screen_image(i)) && strcmp(path, ss->dir) == 0) {
+			mask |= 1u << i;
+		}
+	}
+	return mask;
+}
+
+static void prefetch_done(int res, void *cls)
+{
+	int i;
+	struct slideshow *ss = cls;
+
+	if(res != -1) {
+		ss->state = SS_READY;
+		return;
+	}
+
+	/* drop images which fail to load from the slideshow */
+	free(ss->files[ss->next_slide]);
+	for(i=ss->next_slide; i<ss->num_files - 1; i++) {
+		ss->files[i] = ss->files[i + 1];
+	}
+	ss->num_files--;
+	if(ss->cur > ss->next_slide) {
+		ss->cur--;
+	}
+	ss->state = SS_IDLE;
+}
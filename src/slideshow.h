@@ -0,0 +1,40 @@
+/*
+xlivebg - live wallpapers for the X window system
+Copyright (C) 2019-2020  John Tsiombikas <nuclear@member.fsf.org>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+#ifndef SLIDESHOW_H_
+#define SLIDESHOW_H_
+
+/* Slideshows: when the image of an output is set to a directory, the images in
+ * it are shown in turn, every cfg.slideshow_interval seconds. The next slide is
+ * decoded and uploaded ahead of time in the background, so changing slides
+ * never stalls drawing, and the image manager crossfades between them.
+ */
+
+/* if path is a directory, returns the current slide of its slideshow,
+ * otherwise returns path
+ */
+const char *slideshow_image(const char *path);
+
+/* prefetches and changes slides when it's time, called once per frame */
+void slideshow_update(void);
+
+/* returns the number of microseconds until the next slide change, or -1 if
+ * no slide change is pending
+ */
+long slideshow_timeout(void);
+
+#endif	/* SLIDESHOW_H_ */